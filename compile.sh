@@ -13,6 +13,18 @@ compile_client() {
     g++ -o client src/client.cpp -lraylib -lenet
 }
 
+compile_bots() {
+    g++ -o bots src/bots.cpp -O2
+}
+
+compile_bench() {
+    g++ -o broadcast_bench src/broadcast_bench.cpp -O2 -pthread
+}
+
+compile_lossbench() {
+    g++ -o udp_loss_bench src/udp_loss_bench.cpp -O2 -lenet
+}
+
 compile_windows() {
     RAYLIB_PATH="$1"
     x86_64-w64-mingw32-g++ -o game.exe src/client.cpp \
@@ -24,10 +36,17 @@ compile_windows() {
 if [ "$WHAT" = "all" ]; then
     compile_server
     compile_client
+    compile_bots
 elif [ "$WHAT" = "server" ]; then
     compile_server
 elif [ "$WHAT" = "client" ]; then
     compile_client
+elif [ "$WHAT" = "bots" ]; then
+    compile_bots
+elif [ "$WHAT" = "bench" ]; then
+    compile_bench
+elif [ "$WHAT" = "lossbench" ]; then
+    compile_lossbench
 elif [ "$WHAT" = "windows" ]; then
     if [ -z "$2" ]; then
         echo "Usage: $0 windows <path-to-raylib>"
@@ -0,0 +1,101 @@
+// headless load generator: connects a crowd of bots that wander around and
+// reports how much the server sends back. used to compare server backends
+// under the same load, e.g.
+//   bin/server --io epoll     then     bin/bots 127.0.0.1 500 30
+//   bin/server --io uring     then     bin/bots 127.0.0.1 500 30
+#include "codes.hpp"
+#include "framing.hpp"
+#include "netvent.hpp"
+#include "protocol.hpp"
+#include "transport.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Bot {
+  std::unique_ptr<Transport> server;
+  FrameReader reader;
+  float angle = 0;
+  int x = 100;
+  int y = 100;
+};
+
+int main(int argc, char **argv) {
+  std::string ip = argc > 1 ? argv[1] : "127.0.0.1";
+  int count = argc > 2 ? std::atoi(argv[2]) : 100;
+  int seconds = argc > 3 ? std::atoi(argv[3]) : 10;
+  int move_hz = argc > 4 ? std::atoi(argv[4]) : 30;
+
+  std::vector<Bot> bots;
+  for (int i = 0; i < count; i++) {
+    Bot b;
+    b.server = TcpTransport::connect(ip, 50000, true);
+    if (!b.server)
+      break;
+    // no UDP and no resuming, every bot stays on its one TCP connection
+    b.server->send(netvent::serialize_to_netvent(
+        netvent::val(MSG_HELLO),
+        std::map<std::string, netvent::Value>(
+            {{"version", netvent::val(PROTOCOL_VERSION)},
+             {"caps", netvent::val(0)}})));
+    b.angle = (float)i;
+    bots.push_back(std::move(b));
+  }
+  std::cout << bots.size() << " bots connected" << std::endl;
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto next_move = start;
+  auto move_interval = std::chrono::microseconds(1000000 / std::max(1, move_hz));
+
+  uint64_t bytes_in = 0;
+  uint64_t messages_in = 0;
+  uint64_t messages_out = 0;
+
+  while (clock::now() - start < std::chrono::seconds(seconds)) {
+    if (clock::now() >= next_move) {
+      next_move += move_interval;
+      for (Bot &b : bots) {
+        b.angle += 0.05f;
+        b.x = 400 + (int)(cosf(b.angle) * 300);
+        b.y = 400 + (int)(sinf(b.angle) * 300);
+        b.server->send(netvent::serialize_to_netvent(
+            netvent::val(MSG_PLAYER_MOVE),
+            std::map<std::string, netvent::Value>(
+                {{"x", netvent::val(b.x)},
+                 {"y", netvent::val(b.y)},
+                 {"rot", netvent::val(b.angle)}})));
+        messages_out++;
+      }
+    }
+
+    bool idle = true;
+    for (Bot &b : bots) {
+      int received;
+      while ((received = b.server->receive(b.reader)) > 0) {
+        idle = false;
+        bytes_in += received;
+        std::string_view frame;
+        while (b.reader.next(frame))
+          messages_in++;
+      }
+    }
+    if (idle)
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+  }
+
+  double elapsed =
+      std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << "sent " << messages_out << " moves, received " << messages_in
+            << " messages (" << (uint64_t)(messages_in / elapsed)
+            << "/s, " << (uint64_t)(bytes_in / elapsed / 1024) << " KiB/s)"
+            << std::endl;
+
+  return 0;
+}
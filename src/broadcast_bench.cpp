@@ -0,0 +1,107 @@
+// microbenchmark for broadcasting one player move to every connected client.
+// no sockets are involved: a null reactor throws the queued frames away at
+// the end of every simulated tick, so only the server-side cost is measured.
+//   ./compile.sh bench && ./broadcast_bench
+#include "codes.hpp"
+#include "netvent.hpp"
+#include "reactor.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+class NullReactor : public Reactor {
+public:
+  const char *name() const override { return "null"; }
+  bool open(int) override { return true; }
+  void run(const std::atomic<bool> &) override {}
+
+  void flush() override {
+    for (const client &c : take_flush_list()) {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      clear_queue_locked(c);
+      c->listed = false;
+    }
+  }
+};
+
+std::string move_message(int id, int x) {
+  return netvent::serialize_to_netvent(
+      netvent::val(MSG_PLAYER_MOVE),
+      std::map<std::string, netvent::Value>({{"x", netvent::val(x)},
+                                             {"y", netvent::val(x / 2)},
+                                             {"rot", netvent::val(x * 0.5f)},
+                                             {"id", netvent::val(id)}}));
+}
+
+// what the server did before: the move path serialized the message again
+// for every recipient
+void per_recipient(std::unordered_map<int, client> &clients, int from, int x) {
+  for (const auto &[id, c] : clients)
+    if (id != from)
+      send_message(move_message(from, x), c);
+}
+
+// the old broadcast_message: the client table taken by value and the frame
+// encoded once per recipient
+void copy_table(std::string msg, std::unordered_map<int, client> clients,
+                int exclude) {
+  for (auto &[id, c] : clients)
+    if (id != exclude)
+      send_message(msg, c);
+}
+
+void encode_once(std::unordered_map<int, client> &clients, int from, int x) {
+  broadcast_message(move_message(from, x), clients, from);
+}
+
+template <typename F>
+double time_per_broadcast(NullReactor &reactor, int broadcasts, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < broadcasts; i++) {
+    f(i);
+    if (i % 32 == 31) // one tick's worth of moves
+      reactor.flush();
+  }
+  reactor.flush();
+  std::chrono::duration<double, std::nano> took =
+      std::chrono::steady_clock::now() - start;
+  return took.count() / broadcasts;
+}
+
+int main() {
+  std::cout << std::setw(8) << "clients" << std::setw(16) << "per recipient"
+            << std::setw(16) << "copy table" << std::setw(16) << "encode once"
+            << "   (ns per broadcast)" << std::endl;
+
+  for (int count : {64, 256, 1024}) {
+    NullReactor reactor;
+    std::unordered_map<int, client> clients;
+    for (int id = 0; id < count; id++) {
+      client c = std::make_shared<connection>();
+      c->fd = 1000 + id; // never used, only has to look open
+      c->id = id;
+      c->reactor = &reactor;
+      clients[id] = c;
+    }
+
+    int broadcasts = 2000000 / count;
+    double a = time_per_broadcast(reactor, broadcasts, [&](int i) {
+      per_recipient(clients, i % count, i);
+    });
+    double b = time_per_broadcast(reactor, broadcasts, [&](int i) {
+      copy_table(move_message(i % count, i), clients, i % count);
+    });
+    double c = time_per_broadcast(reactor, broadcasts, [&](int i) {
+      encode_once(clients, i % count, i);
+    });
+
+    std::cout << std::fixed << std::setprecision(0) << std::setw(8) << count
+              << std::setw(16) << a << std::setw(16) << b << std::setw(16) << c
+              << "   " << std::setprecision(1) << a / c << "x / " << b / c
+              << "x" << std::endl;
+  }
+  return 0;
+}
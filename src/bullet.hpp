@@ -8,7 +8,8 @@ public:
   int x, y, shotby_id;
   int bullet_id;
   float r = 10.0f;
-  Vector2 vel;
+  Vector2 vel; // per frame at 60 frames a second
+  Vector2 carry = {0, 0}; // fractions of a pixel left over by move(dt)
 
   Bullet(int x, int y, Vector2 vel, int from_id, int bullet_id = -1)
       : x(x), y(y), vel(vel), shotby_id(from_id), bullet_id(bullet_id) {}
@@ -20,6 +21,17 @@ public:
     y += vel.y;
   }
 
+  // moves by `dt` seconds' worth of frames
+  void move(float dt) {
+    carry.x += vel.x * dt * 60;
+    carry.y += vel.y * dt * 60;
+    int dx = (int)carry.x, dy = (int)carry.y;
+    x += dx;
+    y += dy;
+    carry.x -= dx;
+    carry.y -= dy;
+  }
+
   void show() { DrawCircle(x, y, r, GRAY); }
 };
 
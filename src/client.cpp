@@ -1,5 +1,6 @@
 #include "bullet.hpp"
 #include "codes.hpp"
+#include "compress.hpp"
 #include "constants.hpp"
 #include "drawScale.hpp"
 #include "game.hpp"
@@ -9,11 +10,14 @@
 #include "networking.hpp"
 #include "objects.hpp"
 #include "player.hpp"
+#include "protocol.hpp"
+#include "transport.hpp"
 #include "collision.hpp"
 #include "rainanimation.hpp"
 #include "raylib.h"
 #include "raymath.h"
 #include "resource_manager.hpp"
+#include "udp_channel.hpp"
 #include "umbrella.hpp"
 #include "utils.hpp"
 #include <atomic>
@@ -28,6 +32,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 // Charging station constants and definitions
@@ -47,14 +52,45 @@ ChargingPoint charging_points[4] = {
     {(int)(PLAYING_AREA.width / 2) - CHARGE_OFFSET,
      (int)PLAYING_AREA.height - CHARGE_OFFSET - CHARGE_SIZE}};
 
-// Remove global socket declaration - will be created in main()
-int sock = -1; // Will be initialized in main()
+// connection to the server, set up in main()
+std::unique_ptr<Transport> server;
 
 std::mutex packets_mutex;
 std::list<std::string> packets = {};
 
 std::atomic<bool> running = true;
-std::string network_buffer = "";
+FrameReader network_buffer;
+
+// movement side channel. main thread only; udp_token is set from
+// MSG_CLIENT_ID and the main loop connects with it. a room server behind
+// --router listens on its own port and says which
+UdpClientChannel udp;
+uint32_t udp_token = 0;
+int udp_port = UDP_PORT;
+
+// liveness both ways: MSG_CLIENT_ID says how often the server wants a
+// heartbeat and how long it waits for one; the server is given up on after
+// the same silence. heartbeat_ms stays 0 until then
+int heartbeat_ms = 0;
+int idle_timeout_ms = 0;
+std::atomic<std::chrono::steady_clock::rep> last_heard{0};
+
+// session resume: MSG_CLIENT_ID hands out a session token and world updates
+// and heartbeats carry the server tick. when the connection drops, do_recv()
+// reconnects for up to session_grace_ms and asks for the session back from
+// the last tick heard of, see reconnect(). the main loop takes the new
+// connection over from `reconnected`
+std::string server_address;
+std::atomic<int> session_id{-1};
+std::atomic<int> session_token{0};
+std::atomic<int> session_grace_ms{0};
+// behind --regions, the region server our player is in, so a reconnect is
+// routed there. -1 otherwise
+std::atomic<int> session_region{-1};
+std::atomic<int> last_tick{0};
+std::atomic<bool> reconnecting{false}; // until the server has answered
+std::mutex reconnect_mutex;
+std::unique_ptr<Transport> reconnected;
 Color my_true_color = RED;
 
 // assassin event tracking
@@ -171,34 +207,85 @@ void draw_water_ripples() {
   }
 }
 
-void do_recv() {
-  char buffer[1024];
+// the first message on every connection: a new player, or the session to
+// resume
+std::string hello_message() {
+  std::map<std::string, netvent::Value> data = {
+      {"version", netvent::val(PROTOCOL_VERSION)},
+      {"caps", netvent::val((int)SUPPORTED_CAPS)}};
+  if (session_token != 0) {
+    data["id"] = netvent::val(session_id.load());
+    data["session"] = netvent::val(session_token.load());
+    data["tick"] = netvent::val(last_tick.load());
+    if (session_region != -1)
+      data["region"] = netvent::val(session_region.load());
+  }
+  return netvent::serialize_to_netvent(netvent::val((int)MSG_HELLO), data);
+}
 
-  while (running) {
-    int bytes = recv_data(sock, &buffer, sizeof(buffer), 0);
+// runs on the receive thread once the connection is lost. keeps trying for
+// as long as the server holds on to our player. nullptr if there is no
+// session to resume or it could not get back in time
+Transport *reconnect() {
+  if (session_token == 0)
+    return nullptr;
+  reconnecting = true;
+  auto give_up = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(session_grace_ms);
+  while (running && std::chrono::steady_clock::now() < give_up) {
+    std::unique_ptr<Transport> conn =
+        TcpTransport::connect(server_address, 50000);
+    if (conn) {
+      network_buffer = FrameReader();
+      last_heard = std::chrono::steady_clock::now().time_since_epoch().count();
+      conn->send(hello_message());
+      Transport *raw = conn.get();
+      std::lock_guard<std::mutex> lock(reconnect_mutex);
+      if (!running)
+        return nullptr;
+      reconnected = std::move(conn);
+      return raw;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  }
+  return nullptr;
+}
 
-    if (bytes == 0) {
+void do_recv() {
+  Transport *conn = server.get();
+  while (running) {
+    if (conn->receive(network_buffer) < 0) {
+      if (!running)
+        break;
       std::cout << "Server disconnected.\n";
-      running = false;
-      break;
-    } else if (bytes < 0) {
-      print_socket_error("Error receiving packet");
+      conn = reconnect();
+      if (conn == nullptr) {
+        running = false;
+        break;
+      }
+      std::cout << "Reconnected, resuming session.\n";
+      continue;
+    }
+    last_heard = std::chrono::steady_clock::now().time_since_epoch().count();
+
+    std::string_view packet;
+    std::lock_guard<std::mutex> lock(packets_mutex);
+    while (network_buffer.next(packet)) {
+      if (is_compressed_message(packet)) {
+        std::string unpacked;
+        if (!decompress_message(packet, unpacked)) {
+          std::cerr << "Dropping a corrupt compressed message" << std::endl;
+          continue;
+        }
+        packets.push_back(std::move(unpacked));
+      } else if (!packet.empty())
+        packets.emplace_back(packet);
+    }
+    if (network_buffer.corrupt) {
+      std::cerr << "Server sent an oversized frame" << std::endl;
       running = false;
       break;
     }
-
-    network_buffer.append(buffer, bytes);
-
-    size_t separator_pos;
-    while ((separator_pos = network_buffer.find(';')) != std::string::npos) {
-      std::string packet = network_buffer.substr(0, separator_pos);
-      network_buffer.erase(0, separator_pos + 1);
-
-      if (!packet.empty()) {
-        std::lock_guard<std::mutex> lock(packets_mutex);
-        packets.push_back(packet);
-      }
-    }
   }
 }
 
@@ -212,6 +299,140 @@ enum EventType {
 };
 
 
+void spawn_bullet(Game *game, int from_id, int bullet_id, int x, int y,
+                  float rot) {
+  float angleRad = (-rot + 5) * DEG2RAD;
+  float bspeed = 10;
+
+  Vector2 dir = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -bspeed);
+
+  Bullet new_bullet(x, y, dir, from_id, bullet_id);
+  game->bullets.push_back(new_bullet);
+}
+
+void spawn_raindrop(Game *game, int raindrop_id, float x, float y,
+                    float speed, float size, float rot, float alpha) {
+  RainDrop drop;
+  drop.position.x = x;
+  drop.position.y = y;
+  drop.speed = speed;
+  drop.size = size;
+  drop.rot = rot;
+  drop.alpha = alpha;
+  drop.raindrop_id = raindrop_id;
+
+  game->raindrops.push_back(drop);
+}
+
+// applies one MSG_WORLD_UPDATE: every move, spawn, despawn and departure of a
+// server tick
+void apply_world_update(std::map<std::string, netvent::Value> &data,
+                        Game *game, int my_id) {
+  auto list = [&](const char *key) {
+    auto it = data.find(key);
+    if (it == data.end())
+      return std::vector<netvent::Value>();
+    return it->second.as_table().get_data_vector();
+  };
+
+  for (const netvent::Value &entry : list("moves")) {
+    auto m = entry.as_table().get_data_vector();
+    int id = m[0].as_int();
+    if (id == my_id)
+      continue; // so the movement feels smoother
+    auto player = game->players.find(id);
+    if (player == game->players.end())
+      continue;
+    player->second.nx = m[1].as_int();
+    player->second.ny = m[2].as_int();
+    player->second.rot = m[3].as_float();
+  }
+
+  for (const netvent::Value &entry : list("bullets")) {
+    auto b = entry.as_table().get_data_vector();
+    spawn_bullet(game, b[0].as_int(), b[1].as_int(), b[2].as_int(),
+                 b[3].as_int(), b[4].as_float());
+  }
+
+  for (const netvent::Value &entry : list("raindrops")) {
+    auto r = entry.as_table().get_data_vector();
+    spawn_raindrop(game, r[0].as_int(), r[1].as_float(), r[2].as_float(),
+                   r[3].as_float(), r[4].as_float(), r[5].as_float(),
+                   r[6].as_float());
+  }
+
+  std::unordered_set<int> bullets_gone;
+  for (const netvent::Value &id : list("bullets_gone"))
+    bullets_gone.insert(id.as_int());
+  if (!bullets_gone.empty())
+    game->bullets.erase(std::remove_if(game->bullets.begin(),
+                                       game->bullets.end(),
+                                       [&](const Bullet &b) {
+                                         return bullets_gone.count(b.bullet_id);
+                                       }),
+                        game->bullets.end());
+
+  std::unordered_set<int> raindrops_gone;
+  for (const netvent::Value &id : list("raindrops_gone"))
+    raindrops_gone.insert(id.as_int());
+  if (!raindrops_gone.empty())
+    game->raindrops.erase(
+        std::remove_if(game->raindrops.begin(), game->raindrops.end(),
+                       [&](const RainDrop &r) {
+                         return raindrops_gone.count(r.raindrop_id);
+                       }),
+        game->raindrops.end());
+
+  for (const netvent::Value &id : list("players_left"))
+    game->players.erase(id.as_int());
+}
+
+// the running events as the last join chunk and MSG_RESUME list them. only
+// the ones that are running are listed
+void apply_running_events(std::map<std::string, netvent::Value> &data,
+                          Game *game, int my_id) {
+  if (data.count("darkness")) {
+    darkness_active = true;
+    darkness_offset = {0, 0};
+    last_darkness_update = std::chrono::steady_clock::now();
+  }
+  if (data.count("acid_rain"))
+    acid_rain.start(0.0f);
+  if (data.count("swim"))
+    water_mode = true;
+  if (data.count("assassin_id")) {
+    int assassin_id = data["assassin_id"].as_int();
+    game->players[assassin_id].color = INVISIBLE;
+    if (assassin_id == my_id) {
+      is_assassin = true;
+      my_target_id = data["target_id"].as_int();
+    }
+  }
+}
+
+void stop_events() {
+  darkness_active = false;
+  acid_rain.stop();
+  water_mode = false;
+  water_ripples.clear();
+  last_player_positions.clear();
+  player_ripple_cooldowns.clear();
+  is_assassin = false;
+  my_target_id = -1;
+}
+
+// the server could not resume our session and is joining us as a new
+// player, so nothing we had is valid any more
+void forget_session(Game *game, int *my_id) {
+  game->players.clear();
+  game->bullets.clear();
+  game->raindrops.clear();
+  stop_events();
+  *my_id = -1;
+  session_token = 0;
+  last_tick = 0;
+  reconnecting = false;
+}
 
 void handle_packet(int packet_type, std::string payload, Game *game,
                    int *my_id, ResourceManager *res_man) {
@@ -222,34 +443,80 @@ void handle_packet(int packet_type, std::string payload, Game *game,
   case MSG_GAME_STATE: {
     std::cout << "Received game state: " << payload << std::endl;
     auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    // the join state arrives in chunks: players, then the map, then our own
+    // player with the running events. each chunk only has its own keys
     if (event_name.as_int() == MSG_GAME_STATE) {
-      auto players_table = data["players"].as_table();
-      for (const auto& [key, value] : players_table.get_data_map()) {
-        int player_id = key.as_int();
-        auto player = Player(value.as_table());
-        (*game).players[player_id] = player;
-      }
-      cubes = objects_from_table(data["cubes"].as_table(), res_man->getTex("assets/floor_tile.png"));
-      int current_event = data["current_event"].as_int();
-      if (current_event == EventType::Darkness) {
-        darkness_active = true;
-      } else if (current_event == EventType::AcidRain) {
-        acid_rain.start(0.0f);
-      } else if (current_event == EventType::Assasin) {
-        int assassin_id = data["assassin_id"].as_int();
-        game->players[assassin_id].color = INVISIBLE;
-        if (assassin_id == *my_id) {
-          is_assassin = true;
-          my_target_id = data["target_id"].as_int();
+      if (reconnecting)
+        forget_session(game, my_id);
+      if (data.count("players")) {
+        auto players_table = data["players"].as_table();
+        for (const auto& [key, value] : players_table.get_data_map()) {
+          int player_id = key.as_int();
+          auto player = Player(value.as_table());
+          (*game).players[player_id] = player;
         }
       }
+      if (data.count("cubes"))
+        cubes = objects_from_table(data["cubes"].as_table(), res_man->getTex("assets/floor_tile.png"));
+      // the running events only come with the last chunk
+      apply_running_events(data, game, *my_id);
       break;
     }
   }
+  case MSG_RESUME: {
+    auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    // our session is back. only the players that changed while we were
+    // gone are listed, the events are listed in full. also sent when our
+    // player crosses into another region, which counts its own ticks
+    if (event_name.as_int() == MSG_RESUME) {
+      if (data.count("tick"))
+        last_tick = data["tick"].as_int();
+      game->bullets.clear();
+      game->raindrops.clear();
+      apply_world_update(data, game, *my_id); // moves and players_left
+      if (data.count("players")) {
+        for (const auto &[key, value] : data["players"].as_table().get_data_map())
+          game->players[key.as_int()] = Player(value.as_table());
+      }
+      stop_events();
+      apply_running_events(data, game, *my_id);
+      reconnecting = false;
+    }
+    break;
+  }
+  case MSG_WELCOME: {
+    auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    // what the server agreed to. the features themselves are switched on
+    // by what it sends next, e.g. a UDP or session token in MSG_CLIENT_ID
+    if (event_name.as_int() == MSG_WELCOME) {
+      int version = data["version"].as_int();
+      uint32_t caps = (uint32_t)data["caps"].as_int();
+      std::cout << "Protocol " << version << ", using "
+                << capability_names(caps) << std::endl;
+      if (version < MIN_PROTOCOL_VERSION) {
+        std::cout << "Server is too old.\n";
+        running = false;
+      }
+    }
+    break;
+  }
   case MSG_CLIENT_ID: {
     auto [event_name, data] = netvent::deserialize_from_netvent(payload);
     if (event_name.as_int() == MSG_CLIENT_ID) {
       *my_id = data["id"].as_int();
+      session_id = *my_id;
+      if (data.count("session")) {
+        session_token = data["session"].as_int();
+        session_grace_ms = data["session_grace_ms"].as_int();
+      }
+      if (data.count("udp_token"))
+        udp_token = (uint32_t)data["udp_token"].as_int();
+      udp_port = data.count("udp_port") ? data["udp_port"].as_int() : UDP_PORT;
+      session_region = data.count("region") ? data["region"].as_int() : -1;
+      if (data.count("heartbeat_ms")) {
+        heartbeat_ms = data["heartbeat_ms"].as_int();
+        idle_timeout_ms = data["idle_timeout_ms"].as_int();
+      }
     }
     break;
   }
@@ -390,16 +657,10 @@ void handle_packet(int packet_type, std::string payload, Game *game,
       int y = data["y"].as_int();
       float rot = data["rot"].as_float();
 
-      float angleRad = (-rot + 5) * DEG2RAD;
-      float bspeed = 10;
-
-      Vector2 dir = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -bspeed);
-
       std::cout << "Client: Received bullet " << bullet_id << " from player " << from_id 
                 << " at (" << x << ", " << y << ")" << std::endl;
 
-      Bullet new_bullet(x, y, dir, from_id, bullet_id);
-      game->bullets.push_back(new_bullet);
+      spawn_bullet(game, from_id, bullet_id, x, y, rot);
     }
     break;
   }
@@ -495,17 +756,8 @@ void handle_packet(int packet_type, std::string payload, Game *game,
       float rot = data["rot"].as_float();
       float alpha = data["alpha"].as_float();
 
-      RainDrop drop;
-      drop.position.x = x;
-      drop.position.y = y;
-      drop.speed = speed;
-      drop.size = size;
-      drop.rot = rot;
-      drop.alpha = alpha;
-      drop.raindrop_id = raindrop_id;
-      
-      game->raindrops.push_back(drop);
-      
+      spawn_raindrop(game, raindrop_id, x, y, speed, size, rot, alpha);
+
       std::cout << "Client: Received raindrop " << raindrop_id << " at (" << x << ", " << y << ")" << std::endl;
     }
     break;
@@ -532,6 +784,22 @@ void handle_packet(int packet_type, std::string payload, Game *game,
     }
     break;
   }
+  case MSG_WORLD_UPDATE: {
+    auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    if (event_name.as_int() == MSG_WORLD_UPDATE) {
+      // only the TCP half has the tick, the UDP one may be lost
+      if (data.count("tick"))
+        last_tick = data["tick"].as_int();
+      apply_world_update(data, game, *my_id);
+    }
+    break;
+  }
+  case MSG_HEARTBEAT: {
+    auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    if (event_name.as_int() == MSG_HEARTBEAT && data.count("tick"))
+      last_tick = data["tick"].as_int();
+    break;
+  }
   }
 }
 
@@ -649,7 +917,7 @@ void do_username_prompt(std::string *usernameprompt, bool *usernamechosen,
               {"username", netvent::val(*usernameprompt)},
               {"color", netvent::val(color_to_table(options[*mycolor]))}
           }));
-      send_message(msg, sock);
+      send_message(msg, *server);
     }
   }
 
@@ -1217,7 +1485,7 @@ std::string get_ip_from_args(int argc, char **argv) {
   return std::string("127.0.0.1");
 }
 
-bool switch_weapon(Weapon weapon, Game *game, int my_id, int sock,
+bool switch_weapon(Weapon weapon, Game *game, int my_id, Transport &server,
                    bool flashlight_usable) {
   if (weapon == Weapon::flashlight && !flashlight_usable) {
     return false;
@@ -1234,7 +1502,7 @@ bool switch_weapon(Weapon weapon, Game *game, int my_id, int sock,
       std::map<std::string, netvent::Value>(
           {{"player_id", netvent::val(my_id)},
            {"weapon_id", netvent::val((int)weapon)}}));
-  send_message(msg, sock);
+  send_message(msg, server);
 
   return true;
 }
@@ -1243,30 +1511,14 @@ int main(int argc, char **argv) {
   if (init_sock() == 1)
     return 1;
 
-  // Create socket after Winsock initialization
-  sock = create_socket(ADDRESS_FAMILY_INET, SOCKET_STREAM, 0);
-
-  std::cout << "Socket creation returned: " << sock << std::endl;
-
-  if (sock < 0) {
-    print_socket_error("Failed to create socket");
+  // connect after Winsock initialization. defaults to 127.0.0.1 if no arg
+  server_address = get_ip_from_args(argc, argv);
+  server = TcpTransport::connect(server_address, 50000);
+  if (!server) {
     clean_sock();
-    return 1;
-  }
-
-  socket_address_in sock_addr;
-  sock_addr.sin_family = ADDRESS_FAMILY_INET;
-  sock_addr.sin_port = host_to_network_short(50000);
-  sock_addr.sin_addr.s_addr = ip_string_to_binary(
-      get_ip_from_args(argc, argv).c_str()); // default to 127.0.0.1 if no arg
-
-  if (connect_socket(sock, (struct sockaddr *)&sock_addr, sizeof(sock_addr)) <
-      0) {
-    print_socket_error("Could not connect to server");
-
-    close_socket(sock);
     return -1;
   }
+  send_message(hello_message(), *server);
 
   std::thread recv_thread(do_recv);
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
@@ -1283,6 +1535,7 @@ int main(int argc, char **argv) {
 
   int my_id = -1;
   int server_update_counter = 0;
+  auto next_heartbeat = std::chrono::steady_clock::now();
   bool hasmoved = false;
   int bdelay = 20;
   int canshoot = false;
@@ -1378,12 +1631,52 @@ int main(int argc, char **argv) {
     float heightRatio = (float)GetScreenHeight() / window_size.y;
     float scale = (widthRatio < heightRatio) ? widthRatio : heightRatio;
 
+    {
+      std::lock_guard<std::mutex> lock(reconnect_mutex);
+      if (reconnected)
+        server = std::move(reconnected);
+    }
+
     handle_packets(&game, &my_id, &res_man);
 
-    if (my_id == -1) {
+    if (udp_token != 0) {
+      udp.connect(server_address, udp_port, udp_token);
+      udp_token = 0;
+    }
+    udp.poll([&](std::string packet) {
+      handle_packet(std::atoi(packet.c_str()), packet, &game, &my_id,
+                    &res_man);
+    });
+
+    if (heartbeat_ms > 0 && !reconnecting) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= next_heartbeat) {
+        send_message(netvent::serialize_to_netvent(
+                         netvent::val((int)MSG_HEARTBEAT), {}),
+                     *server);
+        next_heartbeat = now + std::chrono::milliseconds(heartbeat_ms);
+      }
+      std::chrono::steady_clock::time_point heard{
+          std::chrono::steady_clock::duration(last_heard.load())};
+      if (now - heard > std::chrono::milliseconds(idle_timeout_ms)) {
+        std::cout << "Server timed out.\n";
+        // the receive thread sees the connection close and tries to resume.
+        // it is still reading this one, so it is only shut down here and
+        // closed once the new connection takes its place
+        if (session_token != 0) {
+          reconnecting = true;
+          server->shutdown();
+        } else {
+          running = false;
+        }
+      }
+    }
+
+    if (my_id == -1 || reconnecting) {
       BeginDrawing();
       ClearBackground(BLACK);
-      DrawTextScale("waiting for server...", 50, 50, 48, GREEN);
+      DrawTextScale(reconnecting ? "reconnecting..." : "waiting for server...",
+                    50, 50, 48, GREEN);
       EndDrawing();
       continue;
     };
@@ -1475,7 +1768,10 @@ int main(int argc, char **argv) {
               {{"x", netvent::val(game.players.at(my_id).x)},
                {"y", netvent::val(game.players.at(my_id).y)},
                {"rot", netvent::val(game.players.at(my_id).rot)}}));
-      send_message(msg, sock);
+      if (udp.connected())
+        udp.send(msg);
+      else
+        send_message(msg, *server);
 
       server_update_counter = 0;
     }
@@ -1522,7 +1818,7 @@ int main(int argc, char **argv) {
                    {"x", netvent::val((int)spawnPos.x)},
                    {"y", netvent::val((int)spawnPos.y)},
                    {"rot", netvent::val(game.players[my_id].rot)}})),
-          sock);
+          *server);
     }
 
     // flashlight battery
@@ -1535,7 +1831,7 @@ int main(int argc, char **argv) {
         if (flashlight_time_left <= 0.0f) {
           flashlight_time_left = 0.0f;
           flashlight_usable = false;
-          switch_weapon(Weapon::gun_or_knife, &game, my_id, sock,
+          switch_weapon(Weapon::gun_or_knife, &game, my_id, *server,
                         flashlight_usable);
           std::cout << "Flashlight battery depleted!" << std::endl;
         }
@@ -1566,7 +1862,7 @@ int main(int argc, char **argv) {
       }
 
       if (weapon_changed) {
-        switch_weapon(currentWeapon, &game, my_id, sock, flashlight_usable);
+        switch_weapon(currentWeapon, &game, my_id, *server, flashlight_usable);
       }
     }
 
@@ -1601,7 +1897,7 @@ int main(int argc, char **argv) {
 
       if (!umbrella_update_data.is_usable &&
           game.players[my_id].weapon_id == (int)Weapon::umbrella) {
-        switch_weapon(Weapon::gun_or_knife, &game, my_id, sock,
+        switch_weapon(Weapon::gun_or_knife, &game, my_id, *server,
                       flashlight_usable);
       }
 
@@ -1613,7 +1909,7 @@ int main(int argc, char **argv) {
         std::string msg = netvent::serialize_to_netvent(
             netvent::val((int)MSG_UMBRELLA_SHOOT),
             std::map<std::string, netvent::Value>({{"player_id", netvent::val(my_id)}, {"rot", netvent::val(game.players[my_id].rot)}}));
-        send_message(msg, sock);
+        send_message(msg, *server);
       }
 
       if (!umbrella_update_data.is_shooting && umbrella_update_data_last_frame.is_shooting) {
@@ -1623,7 +1919,7 @@ int main(int argc, char **argv) {
         std::string msg = netvent::serialize_to_netvent(
             netvent::val((int)MSG_UMBRELLA_STOP),
             std::map<std::string, netvent::Value>({{"player_id", netvent::val(my_id)}}));
-        send_message(msg, sock);
+        send_message(msg, *server);
       }
       umbrella_update_data_last_frame = umbrella_update_data;
     }
@@ -1861,10 +2157,17 @@ int main(int argc, char **argv) {
 
   running = false;
 
-  shutdown_socket(sock, SHUTDOWN_BOTH);
-  close_socket(sock);
+  udp.close();
+  // only wakes the receive thread, the sockets are closed once it is done
+  server->shutdown();
+  {
+    std::lock_guard<std::mutex> lock(reconnect_mutex);
+    if (reconnected)
+      reconnected->shutdown();
+  }
 
   recv_thread.join();
+  server->close();
 
   CloseWindow();
 
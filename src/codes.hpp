@@ -14,4 +14,10 @@ inline const int MSG_BULLET_DESPAWN = 16;    // changed
 inline const int MSG_UMBRELLA_SHOOT = 17;    // changed
 inline const int MSG_UMBRELLA_STOP = 18;     // changed
 inline const int MSG_RAINDROP_SPAWN = 19;    // new
-inline const int MSG_RAINDROP_DESPAWN = 20;  // new
\ No newline at end of file
+inline const int MSG_RAINDROP_DESPAWN = 20;  // new
+inline const int MSG_WORLD_UPDATE = 21;      // new
+inline const int MSG_HEARTBEAT = 22;         // new
+inline const int MSG_HELLO = 23;             // new
+inline const int MSG_RESUME = 24;            // new
+inline const int MSG_WELCOME = 25;           // new
+inline const int MSG_COMPRESSED = 26;        // new
\ No newline at end of file
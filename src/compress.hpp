@@ -0,0 +1,333 @@
+// LZ77 compression for large messages
+//
+// used on connections that negotiated CAP_COMPRESSION (see protocol.hpp)
+// for messages of at least compress_min_bytes: join and resume state and
+// busy world updates. a compressed message is its own netvent type so a
+// reader can tell it apart from the first line:
+//
+//   "26\n" <4 byte big-endian size of the original> <block>
+//
+// the block is a run of sequences in the style of LZ4. each sequence is a
+// token byte (literal count in the high nibble, match length - 4 in the low
+// one, 15 meaning more length bytes follow), the literals, then a 2 byte
+// little-endian offset back to the match. the last sequence has literals
+// only. the history a match can point into starts with PRESET_DICTIONARY,
+// so even a message's first keys and table syntax are matches. both sides
+// must use the same dictionary; it is part of the protocol version.
+//
+// the dictionary is trained from real payloads with
+// `server --loopback N --ticks T --train-dict`, see train_dictionary()
+#pragma once
+#include "codes.hpp"
+#include "framing.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// trained on join, resume and world update payloads of a 100 client
+// loopback match
+inline const char PRESET_DICTIONARY[] =
+    "id\"=0,\"x\"=193,\"y\"=183},59={\"coloid\"=0,\"x\"=100,\"y\"=100},18={\"colo"
+    "55,\"g\"=41,\"r\"=230},\"id\"=9,\"is_shid\"=0,\"x\"=100,\"y\"=100},20={\"colo"
+    "id\"=0,\"x\"=100,\"y\"=100},34={\"coloid\"=0,\"x\"=100,\"y\"=100},77={\"colo"
+    "01.2],[99,371,698,102.2]]\ntick 1id\"=0,\"x\"=100,\"y\"=100},56={\"colo"
+    "id\"=0,\"x\"=100,\"y\"=100},63={\"colo55,\"g\"=41,\"r\"=230},\"id\"=8,\"is_sh"
+    "5,\"g\"=41,\"r\"=230},\"id\"=14,\"is_sh5,\"g\"=41,\"r\"=230},\"id\"=20,\"is_sh"
+    "5,\"g\"=41,\"r\"=230},\"id\"=37,\"is_sh5,\"g\"=41,\"r\"=230},\"id\"=72,\"is_sh"
+    "5,\"g\"=41,\"r\"=230},\"id\"=66,\"is_sh5,\"g\"=41,\"r\"=230},\"id\"=53,\"is_sh"
+    "id\"=0,\"x\"=100,\"y\"=100},42={\"coloshooting\"=false,\"rot\"=0.0,\"usern"
+    "0\nplayers {1={\"color\"={\"a\"=255,\"21\nmoves [[0,101,378,9.5],[2,544"
+    "\"weapon_id\"=0,\"x\"=100,\"y\"=100}}\n5,\"g\"=41,\"r\"=230},\"id\"=41,\"is_sh"
+    "5,\"is_shooting\"=false,\"rot\"=0.0,,\"username\"=\"unset\",\"weapon_id\"="
+    "5={\"color\"={\"a\"=255,\"b\"=55,\"g\"=4";
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+
+namespace lz {
+
+inline uint32_t read32(const char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t hash(uint32_t v) { return (v * 2654435761u) >> 18; }
+
+inline void put_length(std::string &out, size_t len) {
+  while (len >= 255) {
+    out += (char)255;
+    len -= 255;
+  }
+  out += (char)len;
+}
+
+// the block for `in`, with `dict` as the history before it
+inline std::string compress(std::string_view in, std::string_view dict) {
+  std::string buf;
+  buf.reserve(dict.size() + in.size());
+  buf.append(dict.data(), dict.size());
+  buf.append(in.data(), in.size());
+  const char *base = buf.data();
+  size_t end = buf.size();
+
+  std::vector<int32_t> table(1 << 14, -1);
+  for (size_t i = 0; i + MIN_MATCH <= dict.size(); i++)
+    table[hash(read32(base + i))] = (int32_t)i;
+
+  std::string out;
+  out.reserve(in.size() / 2 + 16);
+  size_t anchor = dict.size();
+  size_t i = dict.size();
+  auto sequence = [&](size_t literals, size_t match, size_t offset) {
+    size_t extra = match >= MIN_MATCH ? match - MIN_MATCH : 0;
+    out += (char)((std::min<size_t>(literals, 15) << 4) |
+                  std::min<size_t>(extra, 15));
+    if (literals >= 15)
+      put_length(out, literals - 15);
+    out.append(base + anchor, literals);
+    if (match == 0)
+      return;
+    out += (char)(offset & 0xff);
+    out += (char)(offset >> 8);
+    if (extra >= 15)
+      put_length(out, extra - 15);
+  };
+
+  while (i + MIN_MATCH <= end) {
+    uint32_t h = hash(read32(base + i));
+    int32_t candidate = table[h];
+    table[h] = (int32_t)i;
+    if (candidate < 0 || i - candidate > MAX_OFFSET ||
+        read32(base + candidate) != read32(base + i)) {
+      i++;
+      continue;
+    }
+    size_t len = MIN_MATCH;
+    while (i + len < end && base[candidate + len] == base[i + len])
+      len++;
+    sequence(i - anchor, len, i - candidate);
+    // keep the table warm inside the match so the next one is found
+    for (size_t j = i + 1; j < i + len && j + MIN_MATCH <= end; j += 2)
+      table[hash(read32(base + j))] = (int32_t)j;
+    i += len;
+    anchor = i;
+  }
+  sequence(end - anchor, 0, 0);
+  return out;
+}
+
+inline bool get_length(std::string_view in, size_t &at, size_t &len) {
+  unsigned char b;
+  do {
+    if (at >= in.size())
+      return false;
+    b = (unsigned char)in[at++];
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+// false if the block is malformed or does not decode to `size` bytes
+inline bool decompress(std::string_view in, size_t size, std::string_view dict,
+                       std::string &out) {
+  std::string buf;
+  buf.reserve(dict.size() + size);
+  buf.append(dict.data(), dict.size());
+  size_t limit = dict.size() + size;
+  size_t at = 0;
+  while (at < in.size()) {
+    unsigned char token = (unsigned char)in[at++];
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(in, at, literals))
+      return false;
+    if (literals > in.size() - at || buf.size() + literals > limit)
+      return false;
+    buf.append(in.data() + at, literals);
+    at += literals;
+    if (at == in.size())
+      break; // the last sequence has no match
+
+    if (in.size() - at < 2)
+      return false;
+    size_t offset = (unsigned char)in[at] | ((unsigned char)in[at + 1] << 8);
+    at += 2;
+    size_t match = token & 15;
+    if (match == 15 && !get_length(in, at, match))
+      return false;
+    match += MIN_MATCH;
+    if (offset == 0 || offset > buf.size() || buf.size() + match > limit)
+      return false;
+    // byte by byte, the match may overlap what it produces
+    size_t from = buf.size() - offset;
+    for (size_t k = 0; k < match; k++)
+      buf += buf[from + k];
+  }
+  if (buf.size() != limit)
+    return false;
+  out.assign(buf, dict.size(), std::string::npos);
+  return true;
+}
+
+} // namespace lz
+
+inline std::string_view preset_dictionary() {
+  return std::string_view(PRESET_DICTIONARY, sizeof(PRESET_DICTIONARY) - 1);
+}
+
+// the MSG_COMPRESSED message for `payload`, or an empty string if it would
+// not be any smaller
+inline std::string compress_message(std::string_view payload) {
+  std::string block = lz::compress(payload, preset_dictionary());
+  std::string out = std::to_string(MSG_COMPRESSED) + "\n";
+  if (out.size() + 4 + block.size() >= payload.size())
+    return "";
+  uint32_t len = (uint32_t)payload.size();
+  char header[4] = {(char)(len >> 24), (char)(len >> 16), (char)(len >> 8),
+                    (char)len};
+  out.append(header, 4);
+  out += block;
+  return out;
+}
+
+inline bool is_compressed_message(std::string_view payload) {
+  std::string prefix = std::to_string(MSG_COMPRESSED) + "\n";
+  return payload.substr(0, prefix.size()) == prefix;
+}
+
+// the original message from a MSG_COMPRESSED one. false if it is corrupt
+inline bool decompress_message(std::string_view payload, std::string &out) {
+  if (!is_compressed_message(payload) || payload.size() < 7)
+    return false;
+  // "26\n" and the size
+  const unsigned char *h = (const unsigned char *)payload.data() + 3;
+  size_t len = ((size_t)h[0] << 24) | ((size_t)h[1] << 16) |
+               ((size_t)h[2] << 8) | (size_t)h[3];
+  if (len > MAX_FRAME_SIZE)
+    return false;
+  return lz::decompress(payload.substr(7), len, preset_dictionary(), out);
+}
+
+// builds a dictionary of at most `size` bytes out of sample payloads. an 8
+// byte string scores, for each message type, the percentage of that type's
+// samples that contain it, if that is at least half. so the keys and table
+// syntax every message of a type has count, and a type that is sent every
+// tick does not drown out the join state. the dictionary is made of the 32
+// byte stretches that cover the most score not covered yet, the best ones
+// last so they sit closest to the message
+inline std::string train_dictionary(const std::vector<std::string> &samples,
+                                    size_t size) {
+  const size_t k = 8, segment = 32;
+  std::map<int, std::vector<const std::string *>> by_type;
+  for (const std::string &s : samples)
+    by_type[std::atoi(s.c_str())].push_back(&s);
+  std::unordered_map<uint64_t, int> score;
+  for (const auto &[type, list] : by_type) {
+    if (list.size() < 4) // too few to tell what they have in common
+      continue;
+    std::unordered_map<uint64_t, int> containing;
+    for (const std::string *s : list) {
+      std::unordered_map<uint64_t, bool> seen;
+      for (size_t i = 0; i + k <= s->size(); i++) {
+        uint64_t key;
+        std::memcpy(&key, s->data() + i, k);
+        if (!seen[key]) {
+          seen[key] = true;
+          containing[key]++;
+        }
+      }
+    }
+    for (const auto &[key, n] : containing) {
+      int percent = (int)(100 * n / list.size());
+      if (percent >= 50)
+        score[key] += percent;
+    }
+  }
+  auto score_at = [&](const std::string &s, size_t i) {
+    uint64_t key;
+    std::memcpy(&key, s.data() + i, k);
+    auto it = score.find(key);
+    return it == score.end() ? 0 : it->second;
+  };
+
+  std::vector<std::string> picked;
+  size_t total = 0;
+  while (total + segment <= size) {
+    const std::string *best = nullptr;
+    size_t best_at = 0;
+    long best_score = 0;
+    for (const std::string &s : samples) {
+      if (s.size() < segment)
+        continue;
+      long window = 0;
+      for (size_t i = 0; i + k <= segment; i++)
+        window += score_at(s, i);
+      for (size_t start = 0;; start++) {
+        if (window > best_score) {
+          best_score = window;
+          best = &s;
+          best_at = start;
+        }
+        if (start + segment >= s.size())
+          break;
+        window -= score_at(s, start);
+        window += score_at(s, start + segment - k + 1);
+      }
+    }
+    if (best == nullptr) // nothing left that scores
+      break;
+    for (size_t i = 0; i + k <= segment; i++) {
+      uint64_t key;
+      std::memcpy(&key, best->data() + best_at + i, k);
+      score.erase(key);
+    }
+    picked.push_back(best->substr(best_at, segment));
+    total += segment;
+  }
+  std::string dict;
+  for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+    dict += *it;
+  return dict;
+}
+
+// what compression saved and cost, by message type. every compress_message
+// call is counted, including those that gained nothing and were sent as is.
+// a frame that is compressed once and queued for many clients counts once
+class CompressionStats {
+public:
+  void add(int type, size_t raw, size_t sent, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = by_type[type];
+    e.messages++;
+    e.raw += raw;
+    e.sent += sent;
+    e.seconds += seconds;
+  }
+
+  void print(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &[type, e] : by_type)
+      out << "  type " << type << ": " << e.messages << " compressed, "
+          << e.raw / 1024 << " KiB -> " << e.sent / 1024 << " KiB (ratio "
+          << (e.sent ? (double)e.raw / e.sent : 0) << "), "
+          << e.seconds * 1e6 / e.messages << " us each" << std::endl;
+  }
+
+private:
+  struct Entry {
+    uint64_t messages = 0;
+    uint64_t raw = 0;
+    uint64_t sent = 0;
+    double seconds = 0;
+  };
+  std::mutex mutex;
+  std::map<int, Entry> by_type;
+};
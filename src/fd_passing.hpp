@@ -0,0 +1,112 @@
+// handing accepted sockets from one process to another
+//
+// the room router (see room_router.hpp) and each room server share a unix
+// SOCK_SEQPACKET socket pair. the router sends every connection it places
+// as one message with the socket attached as SCM_RIGHTS ancillary data, so
+// the room server gets its own descriptor for the same open socket and the
+// router closes its copy. the room server sends its load back the other
+// way as plain text messages. seqpacket keeps message boundaries, so a
+// descriptor never arrives in the middle of something else.
+//
+// regions of a sharded map (see region.hpp) pass a player's connection to
+// each other the same way, with the player's state in the same message
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// both ends of a fresh channel, close-on-exec. false on failure
+inline bool make_fd_channel(int ends[2]) {
+  return socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, ends) == 0;
+}
+
+// sends `payload` as one message, with `fd` attached unless it is -1.
+// false if the other end is gone or its buffer is full
+inline bool send_with_fd(int channel, std::string_view payload, int fd) {
+  iovec iov = {(void *)payload.data(), payload.size()};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd != -1) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  ssize_t sent;
+  do {
+    sent = sendmsg(channel, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (sent < 0 && errno == EINTR);
+  return sent == (ssize_t)payload.size();
+}
+
+// the next message on `channel`, which should be nonblocking, and the
+// descriptor sent with it or -1. returns its size, -1 with errno EAGAIN
+// when there is none yet, or 0 once the other end has closed
+inline ssize_t receive_with_fd(int channel, std::string &payload, int &fd) {
+  fd = -1;
+  for (;;) {
+    // seqpacket reports the whole message's size with MSG_TRUNC
+    char probe;
+    ssize_t size = recv(channel, &probe, 1, MSG_PEEK | MSG_TRUNC);
+    if (size < 0 && errno == EINTR)
+      continue;
+    if (size <= 0)
+      return size;
+    payload.resize(size);
+
+    iovec iov = {payload.data(), payload.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return got;
+    payload.resize(got);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS)
+      std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return got;
+  }
+}
+
+// sends `fd` with a one byte message
+inline bool send_fd(int channel, int fd) {
+  return send_with_fd(channel, "c", fd);
+}
+
+// the next descriptor sent over `channel`, which should be nonblocking.
+// -1 with errno EAGAIN when there is none yet, -1 with errno 0 once the
+// other end has closed. messages without a descriptor are skipped
+inline int receive_fd(int channel) {
+  std::string payload;
+  for (;;) {
+    int fd;
+    ssize_t got = receive_with_fd(channel, payload, fd);
+    if (got == 0)
+      errno = 0;
+    if (got <= 0)
+      return -1;
+    if (fd != -1)
+      return fd;
+  }
+}
+
+// a text message, for the load reports. false if the other end is gone
+inline bool send_text(int channel, const std::string &text) {
+  return send_with_fd(channel, text, -1);
+}
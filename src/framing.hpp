@@ -0,0 +1,183 @@
+// length-prefixed message framing shared by the server and the client
+//
+// every message on the wire is a 4 byte big-endian payload length followed
+// by the payload (a netvent string). FrameReader keeps the bytes of one
+// connection in a ring buffer and hands out complete frames as views into
+// that buffer. a ring that had to grow for a big frame goes back to its
+// usual size once it is empty again, so one big frame is not paid for in
+// memory for the rest of the connection.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const size_t FRAME_HEADER_SIZE = 4;
+const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+// the biggest frame a connection may send before its hello is answered. a
+// hello is far smaller, and the router only ever looks this far for one
+const size_t MAX_HELLO_SIZE = 1024;
+// an empty ring bigger than this is shrunk back to the size it started at
+const size_t RING_KEEP_BYTES = 64 * 1024;
+
+inline void append_frame(std::string &out, std::string_view payload) {
+  uint32_t len = (uint32_t)payload.size();
+  char header[FRAME_HEADER_SIZE] = {(char)(len >> 24), (char)(len >> 16),
+                                    (char)(len >> 8), (char)len};
+  out.append(header, FRAME_HEADER_SIZE);
+  out.append(payload.data(), payload.size());
+}
+
+inline std::string encode_frame(std::string_view payload) {
+  std::string out;
+  out.reserve(FRAME_HEADER_SIZE + payload.size());
+  append_frame(out, payload);
+  return out;
+}
+
+// byte ring with a power of two capacity. grows when a write does not fit
+// and shrinks back when it empties, see RING_KEEP_BYTES
+class RingBuffer {
+public:
+  explicit RingBuffer(size_t capacity = 4096)
+      : data(round_up(capacity)), initial(data.size()) {}
+
+  size_t size() const { return tail - head; }
+  size_t capacity() const { return data.size(); }
+
+  void write(const char *src, size_t len) {
+    if (size() + len > capacity())
+      grow(size() + len);
+
+    size_t mask = capacity() - 1;
+    size_t at = tail & mask;
+    size_t first = std::min(len, capacity() - at);
+    std::memcpy(data.data() + at, src, first);
+    std::memcpy(data.data(), src + first, len - first);
+    tail += len;
+  }
+
+  // copy out without consuming
+  void peek(char *dst, size_t len, size_t offset = 0) const {
+    size_t mask = capacity() - 1;
+    size_t at = (head + offset) & mask;
+    size_t first = std::min(len, capacity() - at);
+    std::memcpy(dst, data.data() + at, first);
+    std::memcpy(dst + first, data.data(), len - first);
+  }
+
+  // pointer to `offset` bytes past the read position if the next `len`
+  // bytes are contiguous in memory, nullptr if they wrap
+  const char *contiguous(size_t offset, size_t len) const {
+    size_t at = (head + offset) & (capacity() - 1);
+    if (at + len > capacity())
+      return nullptr;
+    return data.data() + at;
+  }
+
+  void consume(size_t len) {
+    head += len;
+    if (head != tail)
+      return;
+    head = tail = 0;
+    if (capacity() > std::max(initial, RING_KEEP_BYTES))
+      std::vector<char>(initial).swap(data);
+  }
+
+private:
+  std::vector<char> data;
+  size_t initial;  // capacity to shrink back to
+  size_t head = 0; // read position, free running
+  size_t tail = 0; // write position, free running
+
+  static size_t round_up(size_t n) {
+    size_t cap = 64;
+    while (cap < n)
+      cap <<= 1;
+    return cap;
+  }
+
+  void grow(size_t needed) {
+    std::vector<char> bigger(round_up(needed));
+    size_t len = size();
+    peek(bigger.data(), len);
+    data.swap(bigger);
+    head = 0;
+    tail = len;
+  }
+};
+
+class FrameReader {
+public:
+  // set when the peer announces a frame larger than max_frame
+  bool corrupt = false;
+  // the server holds this at MAX_HELLO_SIZE until the handshake is done,
+  // so a peer that has not said hello cannot make it buffer megabytes
+  size_t max_frame = MAX_FRAME_SIZE;
+
+  void append(const char *bytes, size_t len) {
+    if (pending) {
+      ring.consume(pending);
+      pending = 0;
+    }
+    ring.write(bytes, len);
+  }
+
+  // yields the next complete payload. the view stays valid until the next
+  // call to next() or append(); it only needs a copy if the frame happens
+  // to wrap around the end of the ring
+  bool next(std::string_view &frame) {
+    if (pending) {
+      ring.consume(pending);
+      pending = 0;
+      if (scratch.capacity() > RING_KEEP_BYTES)
+        std::string().swap(scratch);
+    }
+    if (corrupt || ring.size() < FRAME_HEADER_SIZE)
+      return false;
+
+    unsigned char header[FRAME_HEADER_SIZE];
+    ring.peek((char *)header, FRAME_HEADER_SIZE);
+    size_t len = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) |
+                 ((size_t)header[2] << 8) | (size_t)header[3];
+    if (len > max_frame) {
+      corrupt = true;
+      return false;
+    }
+    if (ring.size() < FRAME_HEADER_SIZE + len)
+      return false;
+
+    const char *start = ring.contiguous(FRAME_HEADER_SIZE, len);
+    if (start == nullptr) {
+      scratch.resize(len);
+      ring.peek(scratch.data(), len, FRAME_HEADER_SIZE);
+      start = scratch.data();
+    }
+    frame = std::string_view(start, len);
+    pending = FRAME_HEADER_SIZE + len;
+    return true;
+  }
+
+  size_t buffered() const { return ring.size() - pending; }
+
+  // takes out every byte not handed out by next() yet, complete frames and
+  // all, e.g. to pass a connection on to another process with them
+  std::string take_buffered() {
+    if (pending) {
+      ring.consume(pending);
+      pending = 0;
+    }
+    std::string bytes(ring.size(), '\0');
+    ring.peek(bytes.data(), bytes.size());
+    ring.consume(bytes.size());
+    return bytes;
+  }
+
+private:
+  RingBuffer ring;
+  std::string scratch;
+  size_t pending = 0; // bytes of the frame handed out last
+};
@@ -0,0 +1,121 @@
+// a read-only copy of the game state, for threads other than the tick
+//
+// snapshots are made on request, not every tick: a reader on any thread
+// calls request(), and at the end of its next tick the room's tick thread
+// copies the players, bullets, raindrops, running events and connections
+// into one and publishes it with an atomic shared_ptr store. the copy is as
+// big as the world and the only readers are console commands, so a tick
+// nobody asked about makes none. the price is that a reader waits for up to
+// a tick in wait(); one that wants several rooms asks all of them before
+// waiting on any, so that is one tick in total. the snapshot stays valid,
+// and unchanged, for as long as the reader holds the pointer. the tick
+// never waits for readers.
+//
+// a snapshot is reclaimed once the last reader drops it: the tick copies
+// into a snapshot nobody holds any more instead of a new one, so its maps
+// and vectors keep their allocations from one request to the next
+#pragma once
+#include "game.hpp"
+#include "join_snapshot.hpp"
+#include "rainanimation.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct GameSnapshot {
+  uint64_t tick = 0; // the tick this is the state after
+  playermap players;
+  std::vector<Bullet> bullets;
+  std::vector<RainDrop> raindrops;
+  JoinEvents events;
+
+  // every connection that has joined, and what it negotiated
+  struct Client {
+    int id;
+    int version;
+    uint32_t caps;
+  };
+  std::vector<Client> clients;
+};
+
+class GameSnapshots {
+public:
+  // tick thread only. whether a reader has asked for a snapshot since the
+  // last one was published
+  bool requested() {
+    return wanted.load(std::memory_order_relaxed) &&
+           wanted.exchange(false, std::memory_order_acquire);
+  }
+
+  // tick thread only. a snapshot no reader holds, to fill in for this tick
+  GameSnapshot &next() {
+    for (auto &slot : pool) {
+      if (slot->free.load(std::memory_order_acquire)) {
+        filling = slot.get();
+        break;
+      }
+    }
+    if (!filling) {
+      pool.push_back(std::make_unique<Slot>());
+      filling = pool.back().get();
+    }
+    filling->free.store(false, std::memory_order_relaxed);
+    return filling->snapshot;
+  }
+
+  // tick thread only. makes the snapshot from next() the latest. the slot
+  // is marked free again when the last pointer to it is dropped
+  void publish() {
+    Slot *slot = filling;
+    filling = nullptr;
+    std::shared_ptr<const GameSnapshot> p(
+        &slot->snapshot, [slot](const GameSnapshot *) {
+          slot->free.store(true, std::memory_order_release);
+        });
+    std::atomic_store(&latest, std::move(p));
+    // only ever reached on request, so the lock is off the usual tick
+    {
+      std::lock_guard<std::mutex> lock(published_mutex);
+      published++;
+    }
+    published_cv.notify_all();
+  }
+
+  // any thread. asks for a snapshot of the next tick. returns the ticket
+  // to wait() with
+  uint64_t request() {
+    std::lock_guard<std::mutex> lock(published_mutex);
+    wanted.store(true, std::memory_order_release);
+    return published;
+  }
+
+  // any thread. the snapshot published since request() handed out
+  // `ticket`, or if the tick has not got to it by `deadline` the latest
+  // one, which is nullptr if there has never been one
+  std::shared_ptr<const GameSnapshot>
+  wait(uint64_t ticket, std::chrono::steady_clock::time_point deadline) {
+    {
+      std::unique_lock<std::mutex> lock(published_mutex);
+      published_cv.wait_until(lock, deadline,
+                              [&] { return published != ticket; });
+    }
+    return std::atomic_load(&latest);
+  }
+
+private:
+  struct Slot {
+    GameSnapshot snapshot;
+    std::atomic<bool> free{true};
+  };
+  std::vector<std::unique_ptr<Slot>> pool; // tick thread only
+  Slot *filling = nullptr;
+  std::shared_ptr<const GameSnapshot> latest; // goes before the pool
+  std::atomic<bool> wanted{false};
+  std::mutex published_mutex;
+  std::condition_variable published_cv;
+  uint64_t published = 0; // snapshots so far, under published_mutex
+};
@@ -0,0 +1,180 @@
+// frames on their way from the reactor to the tick
+//
+// a bounded multi-producer, single-consumer ring of preallocated slots.
+// a producer claims a slot with one compare-and-swap on the write position
+// and copies the frame into the slot's string, which keeps its capacity
+// from one lap to the next, so a steady stream of frames allocates nothing.
+// a slot a big frame has grown past SLOT_KEEP_BYTES goes back to its
+// reserved size once that frame has been handled, so a few big frames do
+// not stay allocated in the ring for good.
+// each slot carries a sequence number that says whether it is free for the
+// current lap or holds a published frame, so neither side takes a lock.
+//
+// the consumer drains everything published so far in one batch and hands
+// each frame over in place; the slot is freed once the callback returns.
+// frames come out in the order their slots were claimed, so frames from one
+// connection (pushed by one thread) stay in order.
+//
+// when the ring is full the frame either spills into an unbounded list
+// under a mutex or is dropped, see `spill`. while anything has spilled every
+// producer spills too, and the consumer takes the ring up to the point the
+// spill started before the spilled frames, so ordering holds either way
+#pragma once
+#include "reactor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// a slot string bigger than this, and than its reservation, is given back
+// once its frame has been handled
+const size_t SLOT_KEEP_BYTES = 4096;
+
+class InboundQueue {
+public:
+  struct Frame {
+    client from;
+    std::string data;
+  };
+
+  // frames that went to the spill list, and frames dropped because the ring
+  // was full and spilling is off
+  std::atomic<uint64_t> spilled{0};
+  std::atomic<uint64_t> dropped{0};
+
+  // `slots` is rounded up to a power of two. each slot's string is reserved
+  // `frame_bytes` up front, enough for the frames clients send every tick
+  InboundQueue(size_t slots, bool spill, size_t frame_bytes = 128)
+      : spill(spill), frame_bytes(frame_bytes) {
+    size_t n = 1;
+    while (n < slots)
+      n <<= 1;
+    mask = n - 1;
+    ring = std::make_unique<Slot[]>(n);
+    for (size_t i = 0; i < n; i++) {
+      ring[i].seq.store(i, std::memory_order_relaxed);
+      ring[i].frame.data.reserve(frame_bytes);
+    }
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  // any thread. false if the frame was dropped
+  bool push(const client &from, std::string_view data) {
+    if (!spilling.load(std::memory_order_acquire) && try_push(from, data))
+      return true;
+    if (!spill) {
+      dropped++;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex);
+    spilling.store(true, std::memory_order_relaxed);
+    overflow.push_back({from, std::string(data)});
+    spilled++;
+    return true;
+  }
+
+  // consumer only. calls f(Frame &) for every frame published so far, in
+  // order, and returns how many there were. f may push more frames; those
+  // wait for the next drain
+  template <typename F> size_t drain(F f) {
+    size_t n = 0;
+    if (!spilling.load(std::memory_order_acquire)) {
+      size_t until = head.load(std::memory_order_acquire);
+      while (tail != until && published(tail))
+        n += pop(f);
+      return n;
+    }
+
+    // every slot claimed before the spill list was taken over is older than
+    // anything on it, so those go first even if one is still being written
+    std::list<Frame> spill_list;
+    size_t until;
+    {
+      std::lock_guard<std::mutex> lock(overflow_mutex);
+      spill_list.swap(overflow);
+      until = head.load(std::memory_order_acquire);
+      spilling.store(false, std::memory_order_release);
+    }
+    while (tail != until) {
+      if (!published(tail)) {
+        std::this_thread::yield();
+        continue;
+      }
+      n += pop(f);
+    }
+    for (Frame &frame : spill_list) {
+      f(frame);
+      n++;
+    }
+    return n;
+  }
+
+  // consumer only. throws away everything queued
+  void clear() {
+    drain([](Frame &) {});
+  }
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<size_t> seq;
+    Frame frame;
+  };
+
+  bool try_push(const client &from, std::string_view data) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot = &ring[pos & mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t lap = (intptr_t)seq - (intptr_t)pos;
+      if (lap == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (lap < 0) {
+        return false; // the consumer has not freed this slot yet: full
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    slot->frame.from = from;
+    slot->frame.data.assign(data.data(), data.size());
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool published(size_t pos) const {
+    return ring[pos & mask].seq.load(std::memory_order_acquire) == pos + 1;
+  }
+
+  template <typename F> size_t pop(F &f) {
+    Slot &slot = ring[tail & mask];
+    f(slot.frame);
+    slot.frame.from = nullptr;
+    if (slot.frame.data.capacity() > std::max(frame_bytes, SLOT_KEEP_BYTES)) {
+      std::string fresh;
+      fresh.reserve(frame_bytes);
+      slot.frame.data.swap(fresh);
+    }
+    slot.seq.store(tail + mask + 1, std::memory_order_release);
+    tail++;
+    return 1;
+  }
+
+  const bool spill;
+  const size_t frame_bytes; // each slot's reservation
+  size_t mask;
+  std::unique_ptr<Slot[]> ring;
+  alignas(64) std::atomic<size_t> head{0}; // next slot to claim
+  alignas(64) size_t tail = 0;             // next slot to read, consumer only
+  std::atomic<bool> spilling{false};
+  std::mutex overflow_mutex;
+  std::list<Frame> overflow;
+};
@@ -0,0 +1,144 @@
+// a small work-stealing thread pool for splitting a tick phase over cores
+//
+// parallel_for(begin, end, grain, f) calls f(lo, hi) on pieces of the range
+// and returns once all of them are done. the calling thread splits the
+// range in halves, queues the right half and keeps going with the left, so
+// pieces are only queued as fast as there are threads to take them. every
+// thread has its own queue: it works from the back of its own and steals
+// from the front of the others', which are the biggest pieces left. the
+// caller helps until its range is finished instead of blocking.
+//
+// a range of at most `grain` items, or a pool of one thread, runs inline on
+// the caller with no queueing at all. idle workers sleep on a condition
+// variable, so the pool costs nothing between ticks
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+  // `threads` counts the caller, so a pool of 1 starts no workers
+  explicit JobSystem(int threads) {
+    threads = std::max(1, threads);
+    for (int i = 0; i < threads; i++)
+      queues.push_back(std::make_unique<Queue>());
+    for (int i = 1; i < threads; i++)
+      workers.emplace_back([this, i] { work(i); });
+  }
+
+  ~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers)
+      t.join();
+  }
+
+  int size() const { return (int)queues.size(); }
+
+  // the caller is any thread. callers outside the pool, such as the tick
+  // threads of several rooms, share the first queue
+  template <typename F>
+  void parallel_for(size_t begin, size_t end, size_t grain, F f) {
+    grain = std::max<size_t>(1, grain);
+    if (end - begin <= grain || size() == 1) {
+      if (begin < end)
+        f(begin, end);
+      return;
+    }
+
+    std::atomic<size_t> pending{0};
+    std::function<void(size_t, size_t)> split = [&](size_t lo, size_t hi) {
+      while (hi - lo > grain) {
+        size_t mid = lo + (hi - lo) / 2;
+        pending++;
+        push([&split, &pending, mid, hi] {
+          split(mid, hi);
+          pending--;
+        });
+        hi = mid;
+      }
+      f(lo, hi);
+    };
+    split(begin, end);
+    while (pending > 0) {
+      if (!run_one())
+        std::this_thread::yield();
+    }
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  // which queue belongs to the current thread. 0 for the one that made
+  // the pool
+  static inline thread_local int self = 0;
+
+  void push(std::function<void()> job) {
+    {
+      Queue &q = *queues[self];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.jobs.push_back(std::move(job));
+    }
+    queued++;
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    wake.notify_one();
+  }
+
+  // runs one job: the newest from this thread's queue, or else the oldest
+  // from another's. false if there was nothing to run
+  bool run_one() {
+    std::function<void()> job;
+    int n = size();
+    for (int i = 0; i < n && !job; i++) {
+      Queue &q = *queues[(self + i) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.jobs.empty())
+        continue;
+      if (i == 0) {
+        job = std::move(q.jobs.back());
+        q.jobs.pop_back();
+      } else {
+        job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+      }
+    }
+    if (!job)
+      return false;
+    queued--;
+    job();
+    return true;
+  }
+
+  void work(int index) {
+    self = index;
+    for (;;) {
+      if (run_one())
+        continue;
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake.wait(lock, [&] { return stop || queued > 0; });
+      if (stop)
+        return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<int> queued{0}; // jobs waiting in any queue
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  bool stop = false; // guarded by sleep_mutex
+};
@@ -0,0 +1,265 @@
+// the state a joining client is sent, kept ready between joins
+//
+// every player's entry, the map and the running events are held already
+// serialized. a player's entry is only redone once one of the fields it was
+// built from has changed, the map is serialized once because it never
+// changes after startup, and the events are only redone when one starts or
+// ends. a join chunk is then spliced together from those strings instead of
+// building and serializing netvent tables for the whole match every time.
+//
+// it also remembers the tick each entry last changed in and which players
+// left when, so a client resuming its session is only sent what changed
+// after the last tick it heard of.
+//
+// main thread only, like the players it is built from
+#pragma once
+#include "netvent.hpp"
+#include "objects.hpp"
+#include "player.hpp"
+#include "reactor.hpp"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// the events a joiner has to know about. -1 means no assassin
+struct JoinEvents {
+  bool darkness = false;
+  bool acid_rain = false;
+  bool swim = false;
+  int assassin_id = -1;
+  int target_id = -1;
+
+  bool operator==(const JoinEvents &o) const {
+    return darkness == o.darkness && acid_rain == o.acid_rain &&
+           swim == o.swim && assassin_id == o.assassin_id &&
+           target_id == o.target_id;
+  }
+  bool operator!=(const JoinEvents &o) const { return !(*this == o); }
+};
+
+class JoinSnapshot {
+public:
+  // MSG_GAME_STATE with the given players, skipping any that are gone. empty
+  // if none are left
+  std::string players_chunk(const std::vector<int> &ids,
+                            std::map<int, Player> &players) {
+    std::string list;
+    for (int id : ids) {
+      auto it = players.find(id);
+      if (it == players.end()) // may have left since
+        continue;
+      if (!list.empty())
+        list += ',';
+      list += entry(id, it->second);
+    }
+    if (list.empty())
+      return "";
+    return "0\nplayers {" + list + "}\n";
+  }
+
+  // MSG_GAME_STATE with the map. the same frame goes to every joiner
+  shared_frame map_chunk(const std::vector<Object> &cubes) {
+    if (!map)
+      map = make_frame(map_text(cubes));
+    return map;
+  }
+
+  const std::string &map_text(const std::vector<Object> &cubes) {
+    if (map_serialized.empty()) {
+      std::map<std::string, netvent::Value> data = {
+          {"cubes", netvent::val(objects_to_table(cubes))}};
+      map_serialized = netvent::serialize_to_netvent(
+          netvent::val(0 /* MSG_GAME_STATE */), data);
+    }
+    return map_serialized;
+  }
+
+  // MSG_GAME_STATE with the joiner's own player and the running events
+  std::string final_chunk(int id, Player &p, const JoinEvents &now) {
+    return "0\n" + events_lines(now) + "players {" + entry(id, p) + "}\n";
+  }
+
+  // MSG_RESUME for a client that has everything up to tick `since`: the
+  // players that joined or changed after it, in full, the ones that only
+  // moved as [id, x, y, rot] like in a world update, the ones that left
+  // after it and the running events. the map never changes and is not sent
+  // again
+  std::string resume_chunk(uint64_t since, std::map<int, Player> &players,
+                           const JoinEvents &now) {
+    std::string list;
+    std::vector<netvent::Value> moves;
+    for (auto &[id, p] : players) {
+      Entry &e = refresh(id, p);
+      if (e.changed > since) {
+        if (!list.empty())
+          list += ',';
+        list += entry(id, p);
+      } else if (e.moved > since) {
+        moves.push_back(netvent::val(netvent::arr_table(
+            {netvent::val(id), netvent::val(p.x), netvent::val(p.y),
+             netvent::val(p.rot)})));
+      }
+    }
+    std::vector<netvent::Value> left;
+    for (const Departure &d : departed)
+      if (d.tick > since)
+        left.push_back(netvent::val(d.id));
+
+    std::string out = "24\n" + events_lines(now);
+    if (!left.empty())
+      out += "players_left " + netvent::Table(left).serialize() + "\n";
+    if (!list.empty())
+      out += "players {" + list + "}\n";
+    if (!moves.empty())
+      out += "moves " + netvent::Table(moves).serialize() + "\n";
+    return out;
+  }
+
+  // MSG_RESUME for a client whose player just crossed in from another
+  // region: what it has came from there, so every player but its own is
+  // listed in full, followed by `lines`, world update lines with the
+  // bullets, raindrops, players it should forget and this region's tick
+  std::string region_chunk(int self, std::map<int, Player> &players,
+                           const std::string &lines, const JoinEvents &now) {
+    std::string list;
+    for (auto &[id, p] : players) {
+      if (id == self)
+        continue;
+      if (!list.empty())
+        list += ',';
+      list += entry(id, p);
+    }
+    std::string out = "24\n" + events_lines(now);
+    if (!list.empty())
+      out += "players {" + list + "}\n";
+    return out + lines;
+  }
+
+  // stamps every player that changed since the last call with `tick`. runs
+  // once per tick, right before that tick's world update goes out
+  void note_changes(uint64_t tick, std::map<int, Player> &players) {
+    next_tick = tick;
+    for (auto &[id, p] : players)
+      refresh(id, p);
+    next_tick = tick + 1;
+  }
+
+  // drops a player's cached entry once it has left. the departure is kept
+  // for resuming clients until forget_departures() drops it
+  void forget(int id) {
+    entries.erase(id);
+    departed.push_back({next_tick, id, std::chrono::steady_clock::now()});
+  }
+
+  // forgets departures older than `before`. a client that last heard of a
+  // tick before the newest one dropped can no longer be sent a delta
+  void forget_departures(std::chrono::steady_clock::time_point before) {
+    while (!departed.empty() && departed.front().at < before) {
+      horizon = departed.front().tick;
+      departed.pop_front();
+    }
+  }
+
+  bool can_resume_from(uint64_t tick) const {
+    return tick >= horizon && tick < next_tick;
+  }
+
+private:
+  struct Entry {
+    Player state; // what `text` was built from
+    std::string text; // empty until needed again after a change
+    uint64_t changed = 0; // tick of the last change other than a move
+    uint64_t moved = 0;   // tick of the last change to x, y or rot
+  };
+
+  struct Departure {
+    uint64_t tick;
+    int id;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  std::unordered_map<int, Entry> entries;
+  std::deque<Departure> departed; // oldest first
+  uint64_t next_tick = 0;         // the tick changes seen now belong to
+  uint64_t horizon = 0;           // oldest tick a delta can start from
+  std::string map_serialized;
+  shared_frame map;
+  JoinEvents events;
+  std::string events_text;
+
+  // the fields Player::to_table() puts on the wire, other than the ones a
+  // move changes
+  static bool same_look(const Player &a, const Player &b) {
+    return a.username == b.username && a.weapon_id == b.weapon_id &&
+           a.is_shooting == b.is_shooting && a.color.r == b.color.r &&
+           a.color.g == b.color.g && a.color.b == b.color.b &&
+           a.color.a == b.color.a;
+  }
+
+  static bool same_place(const Player &a, const Player &b) {
+    return a.x == b.x && a.y == b.y && a.rot == b.rot;
+  }
+
+  // the player's entry, stamped with next_tick if it no longer matches
+  Entry &refresh(int id, Player &p) {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+      Entry &e = entries[id];
+      e.state = p;
+      e.changed = e.moved = next_tick;
+      return e;
+    }
+    Entry &e = it->second;
+    bool look = same_look(e.state, p);
+    bool place = same_place(e.state, p);
+    if (look && place)
+      return e;
+    if (!look)
+      e.changed = next_tick;
+    if (!place)
+      e.moved = next_tick;
+    e.state = p;
+    e.text.clear();
+    return e;
+  }
+
+  // `id={...}`, as it appears inside the players table
+  const std::string &entry(int id, Player &p) {
+    Entry &e = refresh(id, p);
+    if (e.text.empty())
+      e.text = netvent::val(id).serialize() + "=" +
+               netvent::val(p.to_table(id)).serialize();
+    return e.text;
+  }
+
+  const std::string &events_lines(const JoinEvents &now) {
+    if (events_text.empty() || now != events) {
+      events = now;
+      events_text = serialize_events(now);
+    }
+    return events_text;
+  }
+
+  // the key lines for the events, without the players line
+  static std::string serialize_events(const JoinEvents &e) {
+    std::map<std::string, netvent::Value> data;
+    if (e.darkness)
+      data["darkness"] = netvent::val(1);
+    if (e.acid_rain)
+      data["acid_rain"] = netvent::val(1);
+    if (e.swim)
+      data["swim"] = netvent::val(1);
+    if (e.assassin_id != -1) {
+      data["assassin_id"] = netvent::val(e.assassin_id);
+      data["target_id"] = netvent::val(e.target_id);
+    }
+    std::string text;
+    for (auto &[key, value] : data)
+      text += key + " " + value.serialize() + "\n";
+    return text;
+  }
+};
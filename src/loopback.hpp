@@ -0,0 +1,138 @@
+// in-memory connections, for running the server tick without sockets
+//
+// LoopbackReactor stands in for the epoll and io_uring backends and hands out
+// a LoopbackTransport as the client end of every connection. nothing moves
+// on its own: what clients sent reaches the server when deliver() runs, and
+// what the server queued reaches the clients when flush() runs, both in the
+// order the connections were made. there is no reactor thread, so the same
+// load always produces the same ticks.
+#pragma once
+#include "reactor.hpp"
+#include "transport.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// loopback connections have no socket. anything but -1 counts as open, and
+// the shutdown() close_locked does on it just fails
+const int LOOPBACK_FD = -2;
+
+struct LoopbackPipe {
+  client server_end;
+  std::string to_server; // sent by the client, not yet delivered
+  std::string to_client; // flushed by the server, not yet received
+  bool client_closed = false;
+};
+
+class LoopbackTransport : public Transport {
+public:
+  explicit LoopbackTransport(std::shared_ptr<LoopbackPipe> pipe)
+      : pipe(std::move(pipe)) {}
+  ~LoopbackTransport() override { close(); }
+
+  const char *name() const override { return "loopback"; }
+
+  bool send(std::string_view payload) override {
+    if (closed())
+      return false;
+    append_frame(pipe->to_server, payload);
+    return true;
+  }
+
+  int receive(FrameReader &reader) override {
+    if (pipe->to_client.empty())
+      return closed() ? -1 : 0;
+    int received = (int)pipe->to_client.size();
+    reader.append(pipe->to_client.data(), pipe->to_client.size());
+    pipe->to_client.clear();
+    return received;
+  }
+
+  // receive() never blocks, there is nobody to wake up
+  void shutdown() override { close(); }
+  void close() override { pipe->client_closed = true; }
+
+private:
+  std::shared_ptr<LoopbackPipe> pipe;
+
+  bool closed() const {
+    return pipe->client_closed || pipe->server_end->fd == -1;
+  }
+};
+
+class LoopbackReactor : public Reactor {
+public:
+  const char *name() const override { return "loopback"; }
+  bool open(int) override { return true; }
+  void run(const std::atomic<bool> &) override {} // see deliver() and flush()
+
+  // a new client, accepted right away
+  std::unique_ptr<LoopbackTransport> connect() {
+    auto pipe = std::make_shared<LoopbackPipe>();
+    pipe->server_end = std::make_shared<connection>();
+    pipe->server_end->fd = LOOPBACK_FD;
+    pipe->server_end->reactor = this;
+    pipes.push_back(pipe);
+    by_connection[pipe->server_end.get()] = pipe.get();
+
+    if (on_accept)
+      on_accept(pipe->server_end);
+    return std::make_unique<LoopbackTransport>(pipe);
+  }
+
+  // hands the server everything sent since the last call, then drops the
+  // connections either end has closed. plays the part of the reactor thread
+  void deliver() {
+    for (auto it = pipes.begin(); it != pipes.end();) {
+      LoopbackPipe &pipe = **it;
+      const client &c = pipe.server_end;
+      if (!pipe.to_server.empty()) {
+        if (!c->closing && on_data)
+          on_data(c, pipe.to_server.data(), pipe.to_server.size());
+        pipe.to_server.clear();
+      }
+
+      if (pipe.client_closed || c->closing) {
+        drop(c);
+        by_connection.erase(c.get());
+        it = pipes.erase(it);
+        continue;
+      }
+      ++it;
+    }
+  }
+
+  // moves every queued frame to its client. a loopback client always keeps
+  // up, so nothing is ever left behind for the next tick
+  void flush() override {
+    auto now = std::chrono::steady_clock::now();
+    for (const client &c : take_flush_list()) {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      auto it = by_connection.find(c.get());
+      if (it != by_connection.end() && c->fd != -1 && !c->closing) {
+        std::string &out = it->second->to_client;
+        for (const shared_frame &frame : c->queue)
+          out.append(*frame);
+        bytes_sent += c->queued_bytes;
+      }
+      clear_queue_locked(c);
+      settle_locked(c, now);
+    }
+  }
+
+private:
+  std::vector<std::shared_ptr<LoopbackPipe>> pipes; // in connection order
+  std::unordered_map<const connection *, LoopbackPipe *> by_connection;
+
+  void drop(const client &c) {
+    {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      c->closing = true;
+      c->fd = -1;
+      clear_queue_locked(c);
+    }
+    if (on_close)
+      on_close(c);
+  }
+};
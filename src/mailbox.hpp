@@ -0,0 +1,35 @@
+// work posted to the thread that owns the game state
+//
+// any thread may post a closure; the owner runs everything posted so far,
+// in order, at a point of its choosing (the start of a tick). posting only
+// takes the lock long enough to append, and run() swaps the whole batch out
+// before calling anything, so a closure may post again without deadlocking
+#pragma once
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class Mailbox {
+public:
+  void post(std::function<void()> f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(std::move(f));
+  }
+
+  // owner thread only. returns how many closures ran
+  size_t run() {
+    std::vector<std::function<void()>> batch;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      batch.swap(pending);
+    }
+    for (auto &f : batch)
+      f();
+    return batch.size();
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<std::function<void()>> pending;
+};
@@ -312,6 +312,22 @@ constexpr uint32_t ADDRESS_ANY = 0;
 constexpr uint32_t ADDRESS_NONE = 0xFFFFFFFF;
 #endif
 
+// Send flag that keeps a write to a closed peer from raising SIGPIPE
+#if __unix__
+constexpr int SEND_NO_SIGNAL = MSG_NOSIGNAL;
+#else
+constexpr int SEND_NO_SIGNAL = 0;
+#endif
+
+// True if the last failed call on a non-blocking socket only had to wait
+inline bool socket_would_block() {
+#if _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
 #ifdef _WIN32
 // Winsock initialization and cleanup
 // These functions should be called once at the start and end of your application.
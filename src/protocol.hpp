@@ -0,0 +1,65 @@
+// protocol version and capabilities, agreed per connection at connect time
+//
+// the first message on a connection is the client's MSG_HELLO with the
+// protocol version it speaks and the capability bits it supports. the server
+// answers with MSG_WELCOME: the version both sides speak and the bits both
+// support and the server has enabled (server_conf `capabilities`). from then
+// on the server only uses those bits on that connection, so a feature can be
+// rolled out to some clients and compared against the rest on the same
+// server.
+//
+// version 1 is the first to say hello, and everything older than it also
+// predates the length-prefixed framing, so there is nothing a version 0
+// client could be sent. one that says nothing for hello_timeout_ms, or says
+// hello without a version, counts as version 0 and is closed.
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// the version this build speaks, and the oldest one it still talks to
+inline const int PROTOCOL_VERSION = 1;
+inline const int MIN_PROTOCOL_VERSION = 1;
+
+enum Capability : uint32_t {
+  CAP_UDP_MOVEMENT = 1u << 0, // moves over the ENet side channel
+  CAP_RESUME = 1u << 1,       // session tokens and MSG_RESUME deltas
+  CAP_COMPRESSION = 1u << 2,  // MSG_COMPRESSED for large messages
+};
+
+// everything this build implements
+inline const uint32_t SUPPORTED_CAPS =
+    CAP_UDP_MOVEMENT | CAP_RESUME | CAP_COMPRESSION;
+
+// the version and capabilities a connection ends up with. a version older
+// than MIN_PROTOCOL_VERSION on either side means the two cannot talk
+struct Negotiated {
+  int version = 0;
+  uint32_t caps = 0;
+
+  bool ok() const { return version >= MIN_PROTOCOL_VERSION; }
+};
+
+inline Negotiated negotiate(int version, uint32_t caps, uint32_t enabled) {
+  Negotiated n;
+  n.version = version < PROTOCOL_VERSION ? version : PROTOCOL_VERSION;
+  n.caps = caps & enabled & SUPPORTED_CAPS;
+  return n;
+}
+
+// e.g. "udp+resume", or "none"
+inline std::string capability_names(uint32_t caps) {
+  static const std::pair<uint32_t, const char *> names[] = {
+      {CAP_UDP_MOVEMENT, "udp"},
+      {CAP_RESUME, "resume"},
+      {CAP_COMPRESSION, "compression"}};
+  std::string out;
+  for (auto &[bit, name] : names) {
+    if (!(caps & bit))
+      continue;
+    if (!out.empty())
+      out += '+';
+    out += name;
+  }
+  return out.empty() ? "none" : out;
+}
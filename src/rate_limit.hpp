@@ -0,0 +1,108 @@
+// inbound rate limits, one token bucket per connection and message type
+//
+// a bucket holds up to one second's worth of messages and refills at the
+// type's rate, so a client may burst after a stall but not keep up more
+// than the rate. checked on the message type alone, before the payload is
+// parsed, and a message over the limit is dropped unread. a client that
+// keeps getting messages dropped for rate_limit_timeout_ms is disconnected.
+// rates are in messages per second from server_conf, 0 for no limit
+#pragma once
+#include "codes.hpp"
+#include "server_config.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// message types below this have their own bucket, anything else shares the
+// last one
+const int RATE_LIMITED_TYPES = 32;
+
+inline int rate_bucket(int type) {
+  return type >= 0 && type < RATE_LIMITED_TYPES ? type : RATE_LIMITED_TYPES - 1;
+}
+
+// the type from the first line of a netvent message, without parsing the
+// rest. -1 if there is no number there
+inline int peek_message_type(std::string_view frame) {
+  int type = 0;
+  size_t i = 0;
+  for (; i < frame.size() && i < 4 && frame[i] >= '0' && frame[i] <= '9'; i++)
+    type = type * 10 + (frame[i] - '0');
+  return i == 0 ? -1 : type;
+}
+
+inline int inbound_rate(int type, const ServerConfig &config) {
+  switch (type) {
+  case MSG_PLAYER_MOVE:
+    return config.move_rate;
+  case MSG_BULLET_SHOT:
+    return config.shot_rate;
+  case MSG_UMBRELLA_SHOOT:
+  case MSG_UMBRELLA_STOP:
+  case MSG_SWITCH_WEAPON:
+  case MSG_EVENT_SUMMON:
+    return config.action_rate;
+  default:
+    return config.message_rate;
+  }
+}
+
+// messages dropped so far, by type, across all clients
+struct InboundDrops {
+  std::array<std::atomic<uint64_t>, RATE_LIMITED_TYPES> by_type{};
+  std::atomic<uint64_t> disconnected{0};
+
+  void count(int type) { by_type[rate_bucket(type)]++; }
+};
+
+class InboundLimiter {
+public:
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  // false if a message of `type` arriving at `now` is over the limit
+  bool allow(int type, time_point now, const ServerConfig &config) {
+    int rate = inbound_rate(type, config);
+    if (rate <= 0)
+      return true;
+
+    Bucket &b = buckets[rate_bucket(type)];
+    if (b.last == time_point()) {
+      b.tokens = rate;
+    } else {
+      std::chrono::duration<double> elapsed = now - b.last;
+      b.tokens = std::min<double>(rate, b.tokens + elapsed.count() * rate);
+    }
+    b.last = now;
+    if (b.tokens >= 1) {
+      b.tokens -= 1;
+      return true;
+    }
+
+    // a drop more than a second after the last one starts a new streak
+    if (over_since == time_point() || now - last_drop > std::chrono::seconds(1))
+      over_since = now;
+    last_drop = now;
+    return false;
+  }
+
+  // true once the client has had messages dropped without a second's break
+  // for longer than rate_limit_timeout_ms
+  bool flooding(time_point now, const ServerConfig &config) const {
+    return over_since != time_point() &&
+           now - last_drop <= std::chrono::seconds(1) &&
+           now - over_since >
+               std::chrono::milliseconds(config.rate_limit_timeout_ms);
+  }
+
+private:
+  struct Bucket {
+    double tokens = 0;
+    time_point last;
+  };
+  std::array<Bucket, RATE_LIMITED_TYPES> buckets;
+  time_point over_since; // start of the current streak of drops
+  time_point last_drop;
+};
@@ -0,0 +1,709 @@
+// connection reactors for the server (linux only)
+#pragma once
+
+#include "fd_passing.hpp"
+#include "framing.hpp"
+#include "networking.hpp"
+#include "rate_limit.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+class Reactor;
+
+// an encoded frame. immutable once built, so one buffer can sit in the
+// queues of every client a message is broadcast to
+typedef std::shared_ptr<const std::string> shared_frame;
+
+inline shared_frame make_frame(std::string_view payload) {
+  return std::make_shared<const std::string>(encode_frame(payload));
+}
+
+// per-connection state. one of these per socket instead of a thread
+struct connection {
+  int fd = -1;
+  // set on accept; the tick moves a resumed connection to its old id
+  std::atomic<int> id{-1};
+  // the match room it was placed in, -1 once closed. a resume can move it
+  // to the room its old player is in
+  std::atomic<int> room{-1};
+  // agreed in the handshake, see protocol.hpp. set by the tick before the
+  // connection is added to the game
+  int version = 0;
+  uint32_t caps = 0;
+  // set by the tick once the handshake is done. until then the reader
+  // only takes frames of up to MAX_HELLO_SIZE
+  std::atomic<bool> welcomed{false};
+  Reactor *reactor = nullptr;
+  FrameReader reader;     // reactor thread only
+  InboundLimiter limiter; // reactor thread only
+  // steady_clock time of the last frame received, for the idle timeout
+  std::atomic<std::chrono::steady_clock::rep> last_heard{0};
+
+  // outbound frames, written out once per tick by Reactor::flush
+  std::mutex out_mutex;
+  std::deque<shared_frame> queue; // frames the kernel has not taken yet
+  size_t queued_bytes = 0;
+  size_t fresh_bytes = 0; // queued since the last flush
+  size_t head_sent = 0;   // bytes of queue.front() already written
+  bool listed = false;  // waiting in the reactor's flush list
+
+  // coalescing: sequence number of queue.front() and, per coalesce key, the
+  // sequence number of the newest frame queued under it
+  uint64_t head_seq = 0;
+  std::unordered_map<uint64_t, uint64_t> latest;
+  bool write_armed = false;
+  std::atomic<bool> closing{false};
+  // being handed to another process, see Reactor::release(). no longer
+  // read, only written until its queue is empty
+  bool released = false;
+
+  // backpressure: set once the bytes left over from earlier ticks pass the
+  // high watermark and cleared when they fall back under the low one
+  bool congested = false;
+  std::chrono::steady_clock::time_point congested_since;
+
+  // io_uring backend: a sendmsg over the front of the queue
+  uint64_t key = 0;
+  std::vector<iovec> iov;
+  msghdr msg{};
+  size_t inflight_frames = 0; // frames the submitted sendmsg points at
+  size_t inflight_sent = 0;
+  bool send_inflight = false;
+};
+
+typedef std::shared_ptr<connection> client;
+
+// frames queued under the same key replace each other while they are still
+// waiting to be written, so a client that falls behind only gets the newest
+// value for e.g. one player's position. 0 means the frame is never replaced
+inline uint64_t coalesce_key(int type, int entity) {
+  return (1ull << 63) | ((uint64_t)(uint32_t)type << 32) | (uint32_t)entity;
+}
+
+inline int set_socket_nonblocking(int sockfd) {
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  if (flags < 0)
+    return -1;
+  return fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// common interface so the server can pick an I/O backend at runtime
+class Reactor {
+public:
+  // all callbacks run on the reactor thread
+  std::function<void(const client &)> on_accept;
+  std::function<void(const client &, const char *, size_t)> on_data;
+  std::function<void(const client &)> on_close;
+
+  // counters for the "stats" command
+  std::atomic<uint64_t> io_syscalls{0};
+  std::atomic<uint64_t> bytes_sent{0};
+  std::atomic<uint64_t> evictions{0};
+  std::atomic<uint64_t> coalesced{0};
+
+  // set before open() when the socket given to it is a room router channel
+  // that connections are passed over (see fd_passing.hpp) rather than a
+  // listening socket. epoll backend only
+  bool passed_connections = false;
+
+  // outbound queue limits, see ServerConfig
+  size_t high_watermark = 256 * 1024;
+  size_t low_watermark = 64 * 1024;
+  size_t max_queued_bytes = 4 * 1024 * 1024;
+  std::chrono::milliseconds evict_after{5000};
+
+  virtual ~Reactor() = default;
+
+  virtual const char *name() const = 0;
+  virtual bool open(int sock) = 0;
+  virtual void run(const std::atomic<bool> &running) = 0;
+
+  // queue a frame for a connection. never touches the socket, the bytes go
+  // out with the next flush(). a frame with a coalesce key overwrites the
+  // unsent frame queued under the same key instead of adding another one.
+  // safe to call from any thread
+  void send(const client &c, shared_frame frame, uint64_t key = 0) {
+    std::lock_guard<std::mutex> lock(c->out_mutex);
+    if (c->closing || c->fd == -1 || frame->empty())
+      return;
+    if (key != 0 && replace_locked(c, key, frame)) {
+      coalesced++;
+      return;
+    }
+    size_t size = frame->size();
+    if (c->queued_bytes + size > max_queued_bytes) {
+      evict_locked(c, "outbound queue full");
+      return;
+    }
+
+    if (key != 0)
+      c->latest[key] = c->head_seq + c->queue.size();
+    c->queued_bytes += size;
+    c->fresh_bytes += size;
+    c->queue.push_back(std::move(frame));
+    list_locked(c);
+  }
+
+  // ask the reactor to drop a connection. safe to call from any thread,
+  // the fd itself is only ever closed on the reactor thread
+  void close(const client &c) {
+    std::lock_guard<std::mutex> lock(c->out_mutex);
+    close_locked(c);
+  }
+
+  // called once per server tick after all messages have been queued
+  virtual void flush() = 0;
+
+  // gives the connection's socket up instead of closing it, so it can be
+  // passed to another process: stops reading, writes out what is queued and
+  // then calls `done` on the reactor thread with the fd, which the caller
+  // now owns, and the bytes read that on_data has not taken out of
+  // c->reader. `done` gets -1 if the connection failed first. on_close is
+  // not called either way. safe to call from any thread. false if the
+  // backend cannot, the connection is then left alone
+  virtual bool release(
+      const client & /* c */,
+      std::function<void(int fd, std::string unread)> /* done */) {
+    return false;
+  }
+
+  // starts serving a connection whose socket came from another process,
+  // with c->fd, c->id and whatever else the caller needs already set. safe
+  // to call from any thread. false if the backend cannot
+  virtual bool adopt(const client & /* c */) { return false; }
+
+protected:
+  static constexpr size_t MAX_IOV = IOV_MAX;
+
+  std::mutex flush_mutex;
+  std::vector<client> flush_list; // connections with queued frames
+
+  std::vector<client> take_flush_list() {
+    std::vector<client> batch;
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    batch.swap(flush_list);
+    return batch;
+  }
+
+  // caller holds c->out_mutex
+  void list_locked(const client &c) {
+    if (c->listed)
+      return;
+    c->listed = true;
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    flush_list.push_back(c);
+  }
+
+  // caller holds c->out_mutex
+  void close_locked(const client &c) {
+    if (!c->closing.exchange(true) && c->fd != -1)
+      shutdown_socket(c->fd, SHUTDOWN_BOTH);
+  }
+
+  // caller holds c->out_mutex
+  void evict_locked(const client &c, const char *why) {
+    if (c->closing)
+      return;
+    std::cerr << "Evicting client " << c->id << ": " << why << " ("
+              << c->queued_bytes << " bytes queued)" << std::endl;
+    evictions++;
+    close_locked(c);
+  }
+
+  // caller holds c->out_mutex. the frame stays where it is in the queue, so
+  // everything queued after it is still delivered after it. frames the
+  // kernel may already be reading are left alone
+  static bool replace_locked(const client &c, uint64_t key,
+                             shared_frame &frame) {
+    auto it = c->latest.find(key);
+    if (it == c->latest.end())
+      return false;
+    if (it->second < c->head_seq) {
+      c->latest.erase(it); // already written
+      return false;
+    }
+
+    size_t index = it->second - c->head_seq;
+    if (index < c->inflight_frames || (index == 0 && c->head_sent > 0))
+      return false;
+
+    shared_frame &slot = c->queue[index];
+    c->queued_bytes = c->queued_bytes - slot->size() + frame->size();
+    slot.swap(frame);
+    return true;
+  }
+
+  // caller holds c->out_mutex. points iov at the unsent part of the queue,
+  // returns how many entries were filled
+  static size_t gather_locked(const client &c, iovec *iov, size_t max) {
+    size_t n = 0;
+    for (auto it = c->queue.begin(); it != c->queue.end() && n < max; ++it) {
+      size_t skip = n == 0 ? c->head_sent : 0;
+      iov[n].iov_base = (void *)((*it)->data() + skip);
+      iov[n].iov_len = (*it)->size() - skip;
+      n++;
+    }
+    return n;
+  }
+
+  // caller holds c->out_mutex. drops `len` written bytes off the queue
+  static void consume_locked(const client &c, size_t len) {
+    c->queued_bytes -= len;
+    while (len > 0) {
+      size_t left = c->queue.front()->size() - c->head_sent;
+      if (len < left) {
+        c->head_sent += len;
+        return;
+      }
+      len -= left;
+      c->queue.pop_front();
+      c->head_seq++;
+      c->head_sent = 0;
+    }
+    if (c->queue.empty())
+      c->latest.clear();
+  }
+
+  static void clear_queue_locked(const client &c) {
+    c->head_seq += c->queue.size();
+    c->latest.clear();
+    c->queue.clear();
+    c->queued_bytes = 0;
+    c->fresh_bytes = 0;
+    c->head_sent = 0;
+  }
+
+  // caller holds c->out_mutex. runs for every listed connection once its
+  // flush has been started; connections that still hold bytes stay listed
+  // so a slow reader is looked at every tick until it drains or is evicted.
+  // frames go out in order, so whatever exceeds this tick's fresh bytes is
+  // backlog a reader that keeps up would already have taken
+  void settle_locked(const client &c,
+                     std::chrono::steady_clock::time_point now) {
+    size_t backlog = c->queued_bytes > c->fresh_bytes
+                         ? c->queued_bytes - c->fresh_bytes
+                         : 0;
+    c->fresh_bytes = 0;
+
+    if (backlog <= low_watermark) {
+      c->congested = false;
+    } else if (backlog > high_watermark && !c->congested) {
+      c->congested = true;
+      c->congested_since = now;
+    }
+    if (c->congested && now - c->congested_since > evict_after)
+      evict_locked(c, "too slow to read");
+
+    c->listed = false;
+    if (!c->queue.empty() && !c->closing)
+      list_locked(c);
+  }
+};
+
+class EpollReactor : public Reactor {
+public:
+  ~EpollReactor() override {
+    if (epoll_fd != -1)
+      close_socket(epoll_fd);
+    if (wake_fd != -1)
+      close_socket(wake_fd);
+  }
+
+  const char *name() const override { return "epoll"; }
+
+  bool open(int sock) override {
+    listen_fd = sock;
+    if (set_socket_nonblocking(listen_fd) < 0) {
+      perror("Failed to make listen socket nonblocking");
+      return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+      perror("epoll_create1");
+      return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+      perror("epoll_ctl listen");
+      return false;
+    }
+
+    // wakes the loop for release() and adopt()
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.data.fd = wake_fd;
+    if (wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+      perror("eventfd");
+      return false;
+    }
+    return true;
+  }
+
+  bool release(const client &c,
+               std::function<void(int fd, std::string unread)> done) override {
+    {
+      std::lock_guard<std::mutex> lock(handover_mutex);
+      release_requests.push_back({c, std::move(done)});
+    }
+    wake();
+    return true;
+  }
+
+  bool adopt(const client &c) override {
+    c->reactor = this;
+    {
+      std::lock_guard<std::mutex> lock(handover_mutex);
+      adopt_requests.push_back(c);
+    }
+    wake();
+    return true;
+  }
+
+  void run(const std::atomic<bool> &running) override {
+    std::vector<epoll_event> events(256);
+
+    while (running) {
+      int n = epoll_wait(epoll_fd, events.data(), (int)events.size(), 100);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("epoll_wait");
+        break;
+      }
+
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd) {
+          if (passed_connections)
+            receive_passed();
+          else
+            accept_pending();
+          continue;
+        }
+        if (fd == wake_fd) {
+          take_handovers();
+          continue;
+        }
+
+        auto it = conns.find(fd);
+        if (it == conns.end())
+          continue;
+        client c = it->second;
+
+        if (events[i].events & EPOLLOUT) {
+          std::lock_guard<std::mutex> lock(c->out_mutex);
+          write_queued_locked(c);
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+            !c->released)
+          read_ready(c);
+      }
+      if (!releasing.empty())
+        settle_releases();
+
+      if (n == (int)events.size())
+        events.resize(events.size() * 2);
+    }
+
+    std::unordered_map<int, client> remaining;
+    remaining.swap(conns);
+    for (auto &[fd, c] : remaining)
+      drop(c, false);
+  }
+
+  // write every connection's frames for this tick with as few sendmsg calls
+  // as the socket buffers allow. whatever does not fit is finished by the
+  // reactor thread on EPOLLOUT, the caller never waits on a socket
+  void flush() override {
+    auto now = std::chrono::steady_clock::now();
+    for (const client &c : take_flush_list()) {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      write_queued_locked(c);
+      settle_locked(c, now);
+    }
+  }
+
+private:
+  struct Release {
+    client c;
+    std::function<void(int, std::string)> done;
+  };
+
+  int epoll_fd = -1;
+  int listen_fd = -1;
+  int wake_fd = -1;
+  std::unordered_map<int, client> conns; // reactor thread only
+  char read_buffer[64 * 1024];
+
+  std::mutex handover_mutex;
+  std::vector<Release> release_requests;
+  std::vector<client> adopt_requests;
+  std::vector<Release> releasing; // reactor thread only
+
+  void wake() {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+  }
+
+  void take_handovers() {
+    uint64_t count;
+    ssize_t ignored = read(wake_fd, &count, sizeof(count));
+    (void)ignored;
+    std::vector<Release> requests;
+    std::vector<client> adopted;
+    {
+      std::lock_guard<std::mutex> lock(handover_mutex);
+      requests.swap(release_requests);
+      adopted.swap(adopt_requests);
+    }
+    for (const client &c : adopted)
+      watch(c);
+    for (Release &r : requests) {
+      {
+        // only written from here on, and only until the queue is empty
+        std::lock_guard<std::mutex> lock(r.c->out_mutex);
+        r.c->released = true;
+        if (r.c->fd != -1) {
+          epoll_event ev{};
+          ev.events = r.c->write_armed ? (uint32_t)EPOLLOUT : 0u;
+          ev.data.fd = r.c->fd;
+          epoll_ctl(epoll_fd, EPOLL_CTL_MOD, r.c->fd, &ev);
+        }
+      }
+      releasing.push_back(std::move(r));
+    }
+    settle_releases();
+  }
+
+  // hands over the released connections whose queues have drained
+  void settle_releases() {
+    for (size_t i = 0; i < releasing.size();) {
+      Release &r = releasing[i];
+      const client &c = r.c;
+      int fd = -1;
+      bool failed = false;
+      {
+        std::lock_guard<std::mutex> lock(c->out_mutex);
+        if (c->fd == -1 || c->closing) {
+          failed = true;
+        } else {
+          write_queued_locked(c);
+          if (c->closing) {
+            failed = true;
+          } else if (c->queue.empty()) {
+            fd = c->fd;
+            c->fd = -1;
+            c->closing = true;
+            clear_queue_locked(c);
+          }
+        }
+      }
+      if (!failed && fd == -1) {
+        i++; // still writing
+        continue;
+      }
+      if (failed) {
+        drop(c, false);
+      } else {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        conns.erase(fd);
+      }
+      r.done(fd, failed ? std::string() : c->reader.take_buffered());
+      releasing.erase(releasing.begin() + i);
+    }
+  }
+
+  void accept_pending() {
+    while (true) {
+      int fd = accept4(listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          perror("Accept failed");
+        return;
+      }
+
+      int yes = 1;
+      set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+      add_connection(fd);
+    }
+  }
+
+  // connections the router has accepted and passed on. they come already
+  // nonblocking and with TCP_NODELAY, both stick to the socket
+  void receive_passed() {
+    while (true) {
+      int fd = receive_fd(listen_fd);
+      if (fd >= 0) {
+        add_connection(fd);
+        continue;
+      }
+      if (errno == 0) {
+        std::cerr << "Room router went away, finishing the matches in "
+                     "progress"
+                  << std::endl;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Receiving a connection");
+      }
+      return;
+    }
+  }
+
+  void add_connection(int fd) {
+    client c = std::make_shared<connection>();
+    c->fd = fd;
+    c->reactor = this;
+    if (watch(c) && on_accept)
+      on_accept(c);
+  }
+
+  // starts polling the connection. an adopted one may have been flushed
+  // before it got here, so it asks for EPOLLOUT if that left bytes over
+  bool watch(const client &c) {
+    std::lock_guard<std::mutex> lock(c->out_mutex);
+    epoll_event ev{};
+    ev.events =
+        EPOLLIN | EPOLLRDHUP | (c->write_armed ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.fd = c->fd;
+    if (c->fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+      perror("epoll_ctl add");
+      if (c->fd != -1)
+        close_socket(c->fd);
+      c->fd = -1;
+      c->closing = true;
+      return false;
+    }
+    conns[c->fd] = c;
+    return true;
+  }
+
+  void read_ready(const client &c) {
+    while (true) {
+      int received = recv_data(c->fd, read_buffer, sizeof(read_buffer), 0);
+      if (received > 0) {
+        if (!c->closing && on_data)
+          on_data(c, read_buffer, received);
+        continue;
+      }
+      if (received < 0 && errno == EINTR)
+        continue;
+      if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+      // orderly shutdown or hard error
+      drop(c, true);
+      return;
+    }
+  }
+
+  // caller holds out_mutex. MSG_MORE tells the kernel another batch follows
+  // when the queue is longer than one iovec array
+  void write_queued_locked(const client &c) {
+    if (c->fd == -1 || c->closing)
+      return;
+
+    iovec iov[MAX_IOV];
+    while (!c->queue.empty()) {
+      msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = gather_locked(c, iov, MAX_IOV);
+      bool more = msg.msg_iovlen < c->queue.size();
+
+      ssize_t sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      io_syscalls++;
+      if (sent < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          close_locked(c);
+        break;
+      }
+      bytes_sent += sent;
+      consume_locked(c, sent);
+    }
+
+    arm_write(c, !c->queue.empty() && !c->closing);
+  }
+
+  // caller holds out_mutex
+  void arm_write(const client &c, bool want) {
+    if (c->write_armed == want)
+      return;
+    epoll_event ev{};
+    ev.events = (c->released ? 0 : EPOLLIN | EPOLLRDHUP) |
+                (want ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.fd = c->fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->write_armed = want;
+  }
+
+  void drop(const client &c, bool notify) {
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      fd = c->fd;
+      if (fd == -1)
+        return;
+      c->closing = true;
+      c->fd = -1;
+      clear_queue_locked(c);
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close_socket(fd);
+
+    client keep = c; // conns.erase would otherwise free it under us
+    conns.erase(fd);
+    if (notify && on_close)
+      on_close(keep);
+  }
+};
+
+inline void send_message(const std::string &msg, const client &c,
+                         uint64_t key = 0) {
+  c->reactor->send(c, make_frame(msg), key);
+}
+
+// encodes the message once and queues that same buffer for every client
+// whose id is not in exclude
+inline void broadcast_message(const std::string &msg,
+                              const std::unordered_map<int, client> &clients,
+                              std::initializer_list<int> exclude = {},
+                              uint64_t key = 0) {
+  shared_frame frame = make_frame(msg);
+  for (auto &[id, c] : clients) {
+    if (std::find(exclude.begin(), exclude.end(), id) != exclude.end())
+      continue;
+    c->reactor->send(c, frame, key);
+  }
+}
+
+inline void broadcast_message(const std::string &msg,
+                              const std::unordered_map<int, client> &clients,
+                              int exclude, uint64_t key = 0) {
+  broadcast_message(msg, clients, {exclude}, key);
+}
@@ -0,0 +1,235 @@
+// one map shared by several server processes, see --regions in server.cpp
+//
+// the map is cut into `count` vertical strips of equal width and region n
+// owns the n-th from the left: it simulates the players, bullets and
+// raindrops inside it and nothing else. every process still has the whole
+// map, the cubes are made once before the regions are forked, so an entity
+// can be judged anywhere.
+//
+// neighbouring regions are joined by a unix SOCK_SEQPACKET socket in the
+// abstract namespace, so there is nothing to clean up on disk. region n
+// listens on its own name and dials n + 1; whichever side of a link drops,
+// the left one dials again once a second. every tick each region sends both
+// neighbours everything it owns within region_border of their shared edge,
+// in full, and the neighbour shows those as ghosts. bullets and raindrops
+// that leave a strip travel in the same message, players travel on their
+// own with their client's socket attached, see fd_passing.hpp. a link
+// carries messages in order, so a neighbour always sees a handoff before the
+// mirror that no longer lists what was handed over.
+//
+// the tick thread owns all of it and never blocks on a link: a neighbour
+// too slow to take the next message has its link reset, which costs one
+// resync since every mirror is complete
+#pragma once
+#include "constants.hpp"
+#include "fd_passing.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// message types on a region link, after the netvent codes of codes.hpp
+const int REGION_MIRROR = 100; // owned entities near the edge, and handoffs
+const int REGION_PLAYER = 101; // one player, with its connection attached
+
+// the two neighbours, as indices into RegionLinks
+const int REGION_LEFT = 0;
+const int REGION_RIGHT = 1;
+
+// how far past its region's edge a player's center gets before it is
+// handed over, so one walking along the edge is not passed back and forth
+const float REGION_HANDOFF_MARGIN = 50;
+
+struct RegionStrip {
+  int index = 0;
+  int count = 1;
+  float left = 0, right = PLAYING_AREA.width;
+
+  static RegionStrip of(int index, int count) {
+    RegionStrip s;
+    s.index = index;
+    s.count = count;
+    s.left = PLAYING_AREA.width * index / count;
+    s.right = PLAYING_AREA.width * (index + 1) / count;
+    return s;
+  }
+
+  bool has_neighbour(int side) const {
+    return side == REGION_LEFT ? index > 0 : index + 1 < count;
+  }
+
+  // the neighbour that owns `x`, or -1 while it is ours. `margin` is how
+  // far past the edge it has to be
+  int beyond(float x, float margin = 0) const {
+    if (x < left - margin && has_neighbour(REGION_LEFT))
+      return REGION_LEFT;
+    if (x >= right + margin && has_neighbour(REGION_RIGHT))
+      return REGION_RIGHT;
+    return -1;
+  }
+
+  // whether `x` is within `border` of the edge shared with `side`
+  bool near(int side, float x, float border) const {
+    return side == REGION_LEFT ? x < left + border : x >= right - border;
+  }
+
+  float center() const { return (left + right) / 2; }
+};
+
+class RegionLinks {
+public:
+  // a message from a neighbour, with the descriptor sent along or -1
+  std::function<void(int side, std::string &payload, int fd)> on_message;
+  // a link came up or went down. one that comes up has seen nothing of the
+  // other side yet, one that went down leaves nothing of it valid
+  std::function<void(int side, bool up)> on_link;
+
+  // `scope` keeps the names of separate servers on one machine apart
+  RegionLinks(std::string scope, int index, int count)
+      : scope(std::move(scope)), strip(RegionStrip::of(index, count)) {}
+
+  ~RegionLinks() {
+    for (int fd : links)
+      if (fd != -1)
+        close(fd);
+    if (listen_fd != -1)
+      close(listen_fd);
+  }
+
+  RegionLinks(const RegionLinks &) = delete;
+  RegionLinks &operator=(const RegionLinks &) = delete;
+
+  // listens for the left neighbour. false on failure
+  bool open() {
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0);
+    sockaddr_un addr;
+    socklen_t len = address(strip.index, addr);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, len) < 0 ||
+        listen(listen_fd, 4) < 0) {
+      perror("Region link");
+      return false;
+    }
+    return true;
+  }
+
+  bool up(int side) const { return links[side] != -1; }
+
+  // takes in a new left link, dials the right one if it is down and reads
+  // whatever both have sent
+  void poll() {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+      // the left neighbour came back, whatever the old link still held is
+      // stale
+      reset(REGION_LEFT);
+      attach(REGION_LEFT, fd);
+    }
+    if (!up(REGION_RIGHT) && strip.has_neighbour(REGION_RIGHT) &&
+        clock::now() >= next_dial) {
+      next_dial = clock::now() + std::chrono::seconds(1);
+      dial();
+    }
+
+    std::string payload;
+    for (int side : {REGION_LEFT, REGION_RIGHT}) {
+      while (up(side)) {
+        int passed;
+        ssize_t got = receive_with_fd(links[side], payload, passed);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        if (got <= 0) {
+          reset(side);
+          break;
+        }
+        if (on_message)
+          on_message(side, payload, passed);
+        else if (passed != -1)
+          close(passed);
+      }
+    }
+  }
+
+  // false if the link is down or could not take the message, which then
+  // resets it. `fd` stays the caller's either way
+  bool send(int side, std::string_view payload, int fd = -1) {
+    if (!up(side))
+      return false;
+    if (send_with_fd(links[side], payload, fd))
+      return true;
+    std::cerr << "Region link " << side_name(side) << " dropped: "
+              << std::strerror(errno) << std::endl;
+    reset(side);
+    return false;
+  }
+
+  static const char *side_name(int side) {
+    return side == REGION_LEFT ? "left" : "right";
+  }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  // what a link can hold before a neighbour counts as too slow: a couple of
+  // seconds of mirrors at a busy edge
+  static const int LINK_BUFFER_BYTES = 4 * 1024 * 1024;
+
+  std::string scope;
+  RegionStrip strip;
+  int listen_fd = -1;
+  int links[2] = {-1, -1};
+  clock::time_point next_dial;
+
+  socklen_t address(int index, sockaddr_un &addr) const {
+    std::string name = scope + "-region-" + std::to_string(index);
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    // abstract: a leading zero byte and no terminator
+    size_t n = std::min(name.size(), sizeof(addr.sun_path) - 1);
+    std::memcpy(addr.sun_path + 1, name.data(), n);
+    return (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + n);
+  }
+
+  void dial() {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un addr;
+    socklen_t len = address(strip.index + 1, addr);
+    if (fd < 0)
+      return;
+    // a unix connect either goes through at once or fails at once
+    if (connect(fd, (sockaddr *)&addr, len) < 0) {
+      close(fd);
+      return;
+    }
+    attach(REGION_RIGHT, fd);
+  }
+
+  void attach(int side, int fd) {
+    int size = LINK_BUFFER_BYTES;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    links[side] = fd;
+    std::cout << "Region link " << side_name(side) << " up" << std::endl;
+    if (on_link)
+      on_link(side, true);
+  }
+
+  void reset(int side) {
+    if (links[side] == -1)
+      return;
+    close(links[side]);
+    links[side] = -1;
+    std::cout << "Region link " << side_name(side) << " down" << std::endl;
+    if (on_link)
+      on_link(side, false);
+  }
+};
@@ -0,0 +1,340 @@
+// front end that spreads the rooms over several room server processes
+//
+// the router owns the listening socket and forks `processes` room servers,
+// each hosting server_conf `rooms` rooms. every accepted connection is
+// handed whole to one of them over its channel (see fd_passing.hpp) and the
+// router closes its copy. it never touches a connection's bytes after that,
+// so it costs one accept and one sendmsg per connection and nothing per
+// message.
+//
+// a connection is placed once its first frame is in. a MSG_HELLO that asks
+// to resume a player goes to the process that player's id belongs to, or
+// the region server it names;
+// anything else goes to the first process under `capacity` connections, or
+// the least loaded one once all are full, the way a room server places
+// connections in its rooms. the frame is only peeked at, so the room server
+// reads it as if it had accepted the connection itself. a client that says
+// nothing for hello_timeout is placed without it.
+//
+// room servers report their connection count every second. one that exits
+// takes only its own players with it: the router sees its channel close and
+// starts a new one in its place, at most once a second. the listening
+// socket and the other room servers carry on untouched
+#pragma once
+#include "codes.hpp"
+#include "fd_passing.hpp"
+#include "framing.hpp"
+#include "netvent.hpp"
+#include "networking.hpp"
+#include "rate_limit.hpp"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+class RoomRouter {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // what a room server process runs, given its index and its end of the
+  // channel. runs in the forked child, its result is the exit status
+  typedef std::function<int(int index, int channel)> RoomMain;
+
+  // `ids_per_process` is how many player ids one room server hands out, so
+  // that id / ids_per_process is the process a resuming player is in
+  RoomRouter(int processes, int capacity, int ids_per_process,
+             clock::duration hello_timeout, RoomMain room_main)
+      : servers(std::max(1, processes)), capacity(capacity),
+        ids_per_process(ids_per_process), hello_timeout(hello_timeout),
+        room_main(std::move(room_main)) {}
+
+  // forks the room servers and places connections accepted on `listen_fd`
+  // until `running` is cleared, then waits for the room servers to exit.
+  // only returns in the router
+  int run(int listen_fd, const std::atomic<bool> &running) {
+    this->listen_fd = listen_fd;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || set_nonblocking(listen_fd) < 0) {
+      perror("Room router");
+      return -1;
+    }
+    watch(listen_fd, EPOLLIN);
+    for (size_t i = 0; i < servers.size(); i++)
+      spawn(i);
+
+    epoll_event events[64];
+    while (running) {
+      int n = epoll_wait(epoll_fd, events, 64, 100);
+      if (n < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        break;
+      }
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd)
+          accept_pending();
+        else if (channels.count(fd))
+          read_channel(channels[fd]);
+        else
+          peek_hello(fd);
+      }
+      place_silent();
+      if (running)
+        restart_exited();
+    }
+
+    // pass the shutdown on, in case the signal was only sent to the router,
+    // and give the room servers time to clean up
+    for (auto &s : servers) {
+      if (s.pid > 0)
+        kill(s.pid, SIGINT);
+    }
+    for (auto &s : servers) {
+      if (s.pid > 0)
+        waitpid(s.pid, nullptr, 0);
+    }
+    return 0;
+  }
+
+private:
+  struct RoomServer {
+    pid_t pid = -1;
+    int channel = -1; // the router's end
+    int load = 0;     // connections, as last reported plus those sent since
+    bool exited = false;
+    clock::time_point started;
+  };
+
+  std::vector<RoomServer> servers;
+  int capacity;
+  int ids_per_process;
+  clock::duration hello_timeout;
+  RoomMain room_main;
+
+  int listen_fd = -1;
+  int epoll_fd = -1;
+  std::unordered_map<int, size_t> channels;          // channel -> server
+  std::unordered_map<int, clock::time_point> waiting; // accepted, no hello yet
+
+  static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  void watch(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  void spawn(size_t index) {
+    RoomServer &s = servers[index];
+    int ends[2];
+    if (!make_fd_channel(ends)) {
+      perror("Room server channel");
+      s.exited = true;
+      s.started = clock::now();
+      return;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      close(ends[0]);
+      close(ends[1]);
+      s.exited = true;
+      s.started = clock::now();
+      return;
+    }
+    if (pid == 0) {
+      // the child keeps nothing of the router's but its own channel end
+      close(ends[0]);
+      close(listen_fd);
+      close(epoll_fd);
+      for (auto &[fd, server] : channels)
+        close(fd);
+      for (auto &[fd, since] : waiting)
+        close(fd);
+      std::exit(room_main((int)index, ends[1]));
+    }
+    close(ends[1]);
+    set_nonblocking(ends[0]);
+    s.pid = pid;
+    s.channel = ends[0];
+    s.load = 0;
+    s.exited = false;
+    s.started = clock::now();
+    channels[s.channel] = index;
+    watch(s.channel, EPOLLIN);
+    std::cout << "Room server " << index << " started, pid " << pid
+              << std::endl;
+  }
+
+  void accept_pending() {
+    while (true) {
+      int fd = accept4(listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          perror("Accept failed");
+        return;
+      }
+      int yes = 1;
+      set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+      waiting[fd] = clock::now();
+      // edge triggered: a partial frame does not wake the loop again until
+      // more of it arrives
+      watch(fd, EPOLLIN | EPOLLRDHUP | EPOLLET);
+      peek_hello(fd);
+    }
+  }
+
+  // places the connection once its first frame is complete
+  void peek_hello(int fd) {
+    char buffer[MAX_HELLO_SIZE];
+    ssize_t got = recv(fd, buffer, sizeof(buffer), MSG_PEEK);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return;
+    if (got <= 0) {
+      forget(fd);
+      close(fd);
+      return;
+    }
+
+    FrameReader reader;
+    reader.append(buffer, got);
+    std::string_view frame;
+    if (reader.next(frame)) {
+      place(fd, home_of(frame));
+    } else if (got == (ssize_t)sizeof(buffer) || reader.corrupt) {
+      place(fd, -1); // not a hello, the room server will deal with it
+    }
+  }
+
+  // the process whose player a resume hello asks for, or -1
+  int home_of(std::string_view frame) const {
+    if (peek_message_type(frame) != MSG_HELLO)
+      return -1;
+    try {
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(std::string(frame));
+      if (!data.count("session"))
+        return -1;
+      // players move between region servers, so their clients say which
+      // one they were in last
+      int index = data.count("region") ? data["region"].as_int()
+                                       : data["id"].as_int() / ids_per_process;
+      if (index < 0 || index >= (int)servers.size())
+        return -1;
+      return index;
+    } catch (const std::exception &) {
+      return -1;
+    }
+  }
+
+  void place_silent() {
+    auto now = clock::now();
+    std::vector<int> due;
+    for (auto &[fd, since] : waiting) {
+      if (now - since > hello_timeout)
+        due.push_back(fd);
+    }
+    for (int fd : due)
+      place(fd, -1);
+  }
+
+  // the first room server under capacity, or the least loaded one
+  int pick() const {
+    int emptiest = -1;
+    for (size_t i = 0; i < servers.size(); i++) {
+      const RoomServer &s = servers[i];
+      if (s.exited)
+        continue;
+      if (s.load < capacity)
+        return (int)i;
+      if (emptiest == -1 || s.load < servers[emptiest].load)
+        emptiest = (int)i;
+    }
+    return emptiest;
+  }
+
+  void place(int fd, int index) {
+    forget(fd);
+    if (index == -1 || servers[index].exited)
+      index = pick();
+    if (index == -1 || !send_fd(servers[index].channel, fd)) {
+      std::cerr << "No room server took the connection" << std::endl;
+    } else {
+      servers[index].load++;
+    }
+    close(fd);
+  }
+
+  void forget(int fd) {
+    waiting.erase(fd);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  // load reports, "load <connections>". end of file once the room server
+  // has exited, however it went
+  void read_channel(size_t index) {
+    RoomServer &s = servers[index];
+    char buffer[64];
+    while (true) {
+      ssize_t got = recv(s.channel, buffer, sizeof(buffer) - 1, 0);
+      if (got > 0) {
+        buffer[got] = 0;
+        if (std::strncmp(buffer, "load ", 5) == 0)
+          s.load = std::atoi(buffer + 5);
+        continue;
+      }
+      if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (got < 0 && errno == EINTR)
+        continue;
+      forget(s.channel);
+      channels.erase(s.channel);
+      close(s.channel);
+      s.channel = -1;
+      s.exited = true;
+      return;
+    }
+  }
+
+  void restart_exited() {
+    auto now = clock::now();
+    for (size_t i = 0; i < servers.size(); i++) {
+      RoomServer &s = servers[i];
+      if (!s.exited || now - s.started < std::chrono::seconds(1))
+        continue;
+      if (s.pid > 0) {
+        int status = 0;
+        waitpid(s.pid, &status, 0);
+        std::cerr << "Room server " << i << " (pid " << s.pid << ") ";
+        if (WIFSIGNALED(status))
+          std::cerr << "was killed by signal " << WTERMSIG(status);
+        else
+          std::cerr << "exited with status " << WEXITSTATUS(status);
+        std::cerr << ", restarting it" << std::endl;
+        s.pid = -1;
+      }
+      spawn(i);
+    }
+  }
+};
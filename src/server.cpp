@@ -1,19 +1,39 @@
 #include "constants.hpp"
 #include "game.hpp"
+#include "game_snapshot.hpp"
+#include "inbound_queue.hpp"
+#include "job_system.hpp"
+#include "join_snapshot.hpp"
+#include "loopback.hpp"
+#include "mailbox.hpp"
 #include "math.h"
 #include "netvent.hpp"
 #include "codes.hpp"
+#include "compress.hpp"
 #include "networking.hpp"
 #include "objects.hpp"
+#include "reactor.hpp"
+#include "region.hpp"
+#include "room_router.hpp"
+#include "uring_reactor.hpp"
 #include "player.hpp"
+#include "protocol.hpp"
+#include "rate_limit.hpp"
+#include "server_config.hpp"
+#include "tick_scheduler.hpp"
+#include "udp_channel.hpp"
 #include "utils.hpp"
 #include "rainanimation.hpp"
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <climits>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <deque>
+#include <iomanip>
 #include <iostream>
 #include <list>
 #include <map>
@@ -24,6 +44,7 @@
 #include <raymath.h>
 #include <set>
 #include <sstream>
+#include <sys/resource.h>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -31,94 +52,482 @@
 
 static int server_socket_fd = -1;
 std::atomic<bool> server_running{true};
+ServerConfig server_config;
+
+// owns accept, read and write for every connection
+std::unique_ptr<Reactor> reactor;
+std::thread reactor_thread;
+// one per tick thread, each pacing the rooms it ticks. made once the config
+// is loaded
+std::vector<std::unique_ptr<TickScheduler>> schedulers;
+
+void print_tick_stats() {
+  for (size_t i = 0; i < schedulers.size(); i++) {
+    const TickScheduler &s = *schedulers[i];
+    uint64_t ran = s.ticks;
+    std::cout << "tick thread " << i << " at " << server_config.tick_rate
+              << "/s (" << s.budget_us() << " us each): "
+              << (ran ? s.busy_us / ran : 0) << " us average, slowest "
+              << s.slowest_us << " us, " << s.overruns << " over budget, "
+              << s.skipped << " skipped" << std::endl;
+  }
+}
 
-std::mutex game_mutex;
-Game game;
-
-// bullet id 
-std::mutex bullet_id_mutex;
-int current_bullet_id = 0;
+// movement side channel, see udp_channel.hpp. one host for every room
+UdpServerChannel udp;
+// behind --router each room server has its own UDP port and its own slice
+// of room indices, so player ids stay unique across processes
+int udp_port = UDP_PORT;
+int first_room = 0;
+
+// behind --regions this process owns one strip of a map shared with the
+// other region servers, and region_links joins it to the ones next to it,
+// see region.hpp. null otherwise. every region is handed the same cubes
+RegionStrip region_strip;
+std::unique_ptr<RegionLinks> region_links;
+std::vector<Object> region_cubes;
+
+// messages dropped by the inbound rate limits, see rate_limit.hpp. TCP
+// connections carry their own limiter, UDP moves are limited by player id
+// in their room
+InboundDrops inbound_drops;
+// the loopback bench runs its ticks back to back, so there the limits go by
+// simulated time, one tick's dt per tick
+bool loopback_clock = false;
+
+std::chrono::steady_clock::time_point limiter_time(uint64_t tick) {
+  if (loopback_clock)
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / server_config.tick_rate) *
+            (double)(tick + 1)));
+  return std::chrono::steady_clock::now();
+}
 
-int get_next_bullet_id() {
-    std::lock_guard<std::mutex> lock(bullet_id_mutex);
-    return current_bullet_id++;
+void print_inbound_drops() {
+  std::cout << "rate limited: " << inbound_drops.disconnected
+            << " clients disconnected, dropped";
+  bool any = false;
+  for (int type = 0; type < RATE_LIMITED_TYPES; type++) {
+    uint64_t n = inbound_drops.by_type[type];
+    if (n == 0)
+      continue;
+    std::cout << " type " << type << " x" << n;
+    any = true;
+  }
+  std::cout << (any ? "" : " nothing") << std::endl;
 }
 
-std::mutex raindrop_id_mutex;
-int current_raindrop_id = 0;
+// what connections waiting in the admission queue sent in their MSG_HELLO,
+// by id. a connection is only looked at once it has said hello or
+// hello_timeout_ms has passed without one
+struct Hello {
+  int version = 0;   // 0 for clients from before the handshake
+  uint32_t caps = 0;
+  int id = -1;       // the player to resume, -1 for a new one
+  int session = 0;   // its session token
+  uint64_t tick = 0; // the last tick the client heard of
+  bool welcomed = false;
+};
 
-int get_next_raindrop_id() {
-    std::lock_guard<std::mutex> lock(raindrop_id_mutex);
-    return current_raindrop_id++;
-}
+// resumable sessions, by player id. when a player's connection drops its
+// session is suspended instead of the player being removed, and a client
+// that reconnects with the token before `expires` takes the player back,
+// see resume_session()
+struct Session {
+  int token = 0;
+  client c; // nullptr while suspended
+  std::chrono::steady_clock::time_point expires;
+};
 
-std::mutex assassin_mutex;
-int assassin_id = -1;
-int assassin_target_id = -1; // target id
-Color original_assassin_color;
-std::chrono::steady_clock::time_point assassin_start_time;
-std::set<int> used_assassin_ids; // used id(s)
+// a client that is being sent the game state. it is in `clients`, so it gets
+// every world update from its first chunk on and what it already has stays
+// current, but it has no player until go_live()
+struct Joiner {
+  client c;
+  std::vector<int> players; // still to send, nearest to the spawn last
+  bool sent_map = false;
+};
 
-// darkness event tracking
-std::mutex darkness_mutex;
-bool darkness_active = false;
-std::chrono::steady_clock::time_point darkness_start_time;
+// splits the bullet and raindrop updates over cores, see job_system.hpp.
+// shared by every room
+std::unique_ptr<JobSystem> jobs;
 
-// acid rain event tracking
-std::mutex acid_rain_mutex;
-bool acid_rain_active = false;
-std::chrono::steady_clock::time_point acid_rain_start_time;
+enum EventType {
+  Darkness = 0,
+  Assasin = 1,
+  Clear = 2,
+  AcidRain = 3,
+  Swim = 4,
+  NOTHING = 100
+};
 
-typedef std::list<std::pair<int, std::string>> packetlist;
+// everything that changed during a tick. sent to every client as a single
+// MSG_WORLD_UPDATE when the tick ends instead of one message per change.
+// only touched by the room's tick
+struct WorldUpdate {
+  std::map<int, netvent::Value> moves; // newest position per player
+  std::map<int, netvent::Value> bullets;
+  std::map<int, netvent::Value> raindrops;
+  std::vector<netvent::Value> bullets_gone;
+  std::vector<netvent::Value> raindrops_gone;
+  std::vector<netvent::Value> players_left;
+
+  void player_moved(int id, int x, int y, float rot) {
+    moves[id] = netvent::val(netvent::arr_table(
+        {netvent::val(id), netvent::val(x), netvent::val(y), netvent::val(rot)}));
+  }
 
-std::mutex packets_mutex;
-packetlist packets;
+  void bullet_shot(int player_id, int bullet_id, int x, int y, float rot) {
+    bullets[bullet_id] = netvent::val(netvent::arr_table(
+        {netvent::val(player_id), netvent::val(bullet_id), netvent::val(x),
+         netvent::val(y), netvent::val(rot)}));
+  }
 
-std::mutex clients_mutex;
-std::unordered_map<int, client> clients;
+  void raindrop_spawned(const RainDrop &d) {
+    raindrops[d.raindrop_id] = netvent::val(netvent::arr_table(
+        {netvent::val(d.raindrop_id), netvent::val(d.position.x),
+         netvent::val(d.position.y), netvent::val(d.speed),
+         netvent::val(d.size), netvent::val(d.rot), netvent::val(d.alpha)}));
+  }
 
-std::mutex running_mutex;
-std::map<int, bool> is_running;
+  // something that spawned and vanished within the same tick is never sent
+  void bullet_despawned(int bullet_id) {
+    if (bullets.erase(bullet_id) == 0)
+      bullets_gone.push_back(netvent::val(bullet_id));
+  }
 
-int last_assassin_id = -1; // previous assassin id
+  void raindrop_despawned(int raindrop_id) {
+    if (raindrops.erase(raindrop_id) == 0)
+      raindrops_gone.push_back(netvent::val(raindrop_id));
+  }
 
-std::mutex pending_assassin_mutex;
-std::map<int, std::chrono::steady_clock::time_point> pending_assassins;
+  void player_left(int id) {
+    moves.erase(id);
+    players_left.push_back(netvent::val(id));
+  }
 
-std::set<int> previous_targets; // previous targets
+  bool has_moves() const { return !moves.empty(); }
 
-// swim
-std::mutex swim_mutex;
-bool water_mode = false;
+  bool has_events() const {
+    return !bullets.empty() || !raindrops.empty() || !bullets_gone.empty() ||
+           !raindrops_gone.empty() || !players_left.empty();
+  }
 
-// cubes on the map
-std::vector<Object> cubes = get_rand_cubes(155, CUBE_SIZE);
-//std::vector<Object> cubes;
+  bool empty() const { return !has_moves() && !has_events(); }
+
+  // moves go over UDP to clients that have it, so either half can be left
+  // out. spawns are listed before despawns, the client applies them in that
+  // order
+  // the events half carries the tick, which is what a client resuming its
+  // session reports back. moves are left out of that, UDP may lose them
+  std::string serialize(bool with_moves, bool with_events,
+                        uint64_t tick) const {
+    std::map<std::string, netvent::Value> data;
+    auto add = [&](const char *key, std::vector<netvent::Value> list) {
+      if (!list.empty())
+        data[key] = netvent::val(netvent::Table(list));
+    };
+    auto values = [](const std::map<int, netvent::Value> &m) {
+      std::vector<netvent::Value> list;
+      for (auto &[id, v] : m)
+        list.push_back(v);
+      return list;
+    };
+    if (with_moves)
+      add("moves", values(moves));
+    if (with_events) {
+      add("bullets", values(bullets));
+      add("raindrops", values(raindrops));
+      add("bullets_gone", bullets_gone);
+      add("raindrops_gone", raindrops_gone);
+      add("players_left", players_left);
+      data["tick"] = netvent::val((int)tick);
+    }
+    return netvent::serialize_to_netvent(netvent::val(MSG_WORLD_UPDATE), data);
+  }
 
-// Raindrops are now part of game state (game.raindrops)
-// Lock order: game_mutex -> assassin_mutex -> pending_assassin_mutex ->
-// darkness_mutex -> acid_rain_mutex -> swim_mutex -> clients_mutex This order must be
-// maintained in all functions to prevent deadlocks
+  void clear() { *this = WorldUpdate(); }
+};
 
-enum EventType {
-  Darkness = 0,
-  Assasin = 1,
-  Clear = 2,
-  AcidRain = 3,
-  Swim = 4,
-  NOTHING = 100
+const float UMBRELLA_SHOOT_COOLDOWN = 0.15f; // 150ms between shots
+
+// player ids handed out per room. room n's players are n * ROOM_ID_SPAN and
+// up, so the UDP channel and a resuming client's hello, which only carry a
+// player id, lead straight to the room, and the router to its process
+const int ROOM_ID_SPAN = 1 << 16;
+
+// server_conf inbound_queue_slots, or if that is 0 the most frames the rate
+// limits let a full room send between two ticks: a full bucket of each
+// kind from every seat. InboundQueue rounds it up to a power of two
+size_t inbound_queue_slots() {
+  if (server_config.inbound_queue_slots > 0)
+    return server_config.inbound_queue_slots;
+  int per_seat = server_config.move_rate + server_config.shot_rate +
+                 server_config.action_rate + server_config.message_rate;
+  return (size_t)std::max(1, server_config.room_capacity) *
+         std::max(1, per_seat);
+}
+
+// connection::room of a connection being handed to a neighbouring region.
+// what it sends in the meantime goes along with it
+const int ROOM_HANDED_OFF = -2;
+
+// one match: its game state, map, events and clients. a process hosts
+// server_conf `rooms` of them on the one reactor and UDP host, each ticked
+// by one of the tick threads. everything in a room belongs to the thread
+// that ticks it and is only touched by its tick; other threads hand it work
+// through queues instead of taking locks: the reactor through inbound,
+// admission_queue and closed_clients, and the console through tick_inbox
+struct Room {
+  explicit Room(int index)
+      : index(index), id_base((first_room + index) * ROOM_ID_SPAN),
+        inbound(std::make_unique<InboundQueue>(
+            inbound_queue_slots(),
+            server_config.inbound_queue_full != "drop")) {
+    init_server_objects();
+    if (!region_cubes.empty())
+      cubes = region_cubes;
+    current_bullet_id = current_raindrop_id = region_strip.index;
+  }
+
+  const int index; // in `rooms`
+  const int id_base;
+
+  // connections placed in the room and not closed yet, see pick_room()
+  std::atomic<int> population{0};
+  std::atomic<uint64_t> tick_count{0};
+
+  Game game;
+
+  // bullet id 
+  int current_bullet_id = 0;
+
+  int get_next_bullet_id();
+
+  int current_raindrop_id = 0;
+
+  int get_next_raindrop_id();
+
+  int assassin_id = -1;
+  int assassin_target_id = -1; // target id
+  Color original_assassin_color;
+  std::chrono::steady_clock::time_point assassin_start_time;
+  std::set<int> used_assassin_ids; // used id(s)
+
+  // darkness event tracking
+  bool darkness_active = false;
+  std::chrono::steady_clock::time_point darkness_start_time;
+
+  // acid rain event tracking
+  bool acid_rain_active = false;
+  std::chrono::steady_clock::time_point acid_rain_start_time;
+
+  // random events: one at `event_delay` ms into every five minute window
+  // starting at `event_window`, -1 once it has run
+  std::mt19937 event_rng{std::random_device{}()};
+  std::chrono::steady_clock::time_point event_window;
+  int event_delay = -1;
+
+  // frames read off this room's TCP connections, with the connection they
+  // came from, see inbound_queue.hpp. the tick resolves the sender's id,
+  // since ids are only handed out there
+  std::unique_ptr<InboundQueue> inbound;
+  // moves for this room's players that came in over UDP, whichever room's
+  // tick polled the host, and this tick's batch of them
+  std::mutex udp_mutex;
+  std::vector<std::pair<int, std::string>> udp_inbox, udp_batch;
+  std::vector<std::pair<client, std::string>> udp_packets;
+  std::unordered_map<int, InboundLimiter> udp_limiters;
+
+  std::unordered_map<int, client> clients;
+  // ids removed this tick. not handed out again until the world update that
+  // says they left has been queued
+  std::set<int> leaving_ids;
+  // ids of accepted connections waiting in the admission queue
+  std::set<int> joining_ids;
+
+  // accepted connections, in order, waiting for admit_joiners() to start them.
+  // the reactor appends, the tick gives each one an id and admits it
+  std::mutex admission_mutex;
+  std::deque<client> admission_queue;
+
+  std::unordered_map<int, Hello> hellos;
+
+  std::unordered_map<int, Session> sessions;
+  std::mt19937 session_rng{std::random_device{}()};
+
+  // connections the reactor has closed. on_client_closed only marks them here,
+  // the next tick removes or suspends the player
+  std::mutex closed_mutex;
+  std::vector<client> closed_clients;
+
+  int last_assassin_id = -1; // previous assassin id
+
+  std::map<int, std::chrono::steady_clock::time_point> pending_assassins;
+
+  std::set<int> previous_targets; // previous targets
+
+  // swim
+  bool water_mode = false;
+
+  // the barrel and chargers, and the cubes on the map
+  std::vector<Object> objects;
+  std::vector<Object> cubes = get_rand_cubes(155, CUBE_SIZE);
+  //std::vector<Object> cubes;
+
+  // what joining clients are sent, kept serialized
+  JoinSnapshot join_snapshot;
+  std::vector<Joiner> joining;
+  shared_frame compressed_map;
+
+  // the state after the last tick, for the console and anything else that
+  // reads it off the tick thread, see game_snapshot.hpp
+  GameSnapshots snapshots;
+
+  // console commands, and resumes handed over from other rooms
+  Mailbox tick_inbox;
+
+  WorldUpdate world_update;
+
+  // Umbrella shooting cooldown system
+  std::map<int, std::chrono::steady_clock::time_point> umbrella_shoot_cooldowns;
+
+  std::vector<char> despawn_flags;
+  std::chrono::steady_clock::time_point next_heartbeat;
+
+  // behind --regions, see region.hpp. ghosts are what a neighbour owns near
+  // our edge, by id, with the side they are mirrored from. ghost players sit
+  // in game.players so bullets hit them and joiners see them, but only the
+  // neighbour moves them; ghost bullets and raindrops are only shown.
+  // held_until keeps one that was just handed over until the neighbour's
+  // mirrors list it, or for a second
+  template <typename T = bool> struct Ghost {
+    int side = 0;
+    uint64_t held_until = 0;
+    T state{};
+  };
+  std::unordered_map<int, Ghost<>> ghost_players;
+  std::unordered_map<int, Ghost<Bullet>> ghost_bullets;
+  std::unordered_map<int, Ghost<RainDrop>> ghost_raindrops;
+
+  // a player whose connection is being handed to a neighbour. the reactor
+  // first writes out what is queued for it, see Reactor::release(), and
+  // what the client sends until then is carried along
+  struct Handoff {
+    int side;
+    client c;
+    int token; // its session
+    std::vector<int> known; // players its client has been told of
+    std::string state;
+    std::string carried; // frames, encoded again
+    bool released = false;
+    int fd = -1;
+    std::string unread;
+  };
+  std::unordered_map<int, Handoff> handoffs;
+  // bullets and raindrops that left the strip this tick, for the next mirror
+  std::vector<netvent::Value> handed_bullets[2], handed_raindrops[2];
+  int id_cursor = 0;
+
+  void clear_assassin_state();
+  RainDrop raindrop_from_player(int player_id);
+  JoinEvents running_events();
+  void go_live(const client &c);
+  void admit(const client &c);
+  void assign_id(const client &c);
+  void start_join(const client &c);
+  bool send_join_chunk(Joiner &j);
+  bool resume_session(const client &c, const Hello &hello);
+  std::string in_flight_lines(WorldUpdate &here);
+  bool hand_off(const client &c, const Hello &hello, Room &to);
+  void adopt(const client &c, const Hello &hello);
+  void admit_joiners();
+  void closed(const client &c);
+  bool check_assassin_collision(int assassin_id, int target_id, int assassin_x,
+                                int assassin_y, float assassin_rot);
+  void select_new_target(int assassin_id, bool is_initial_target);
+  void make_player_assassin(int target_id);
+  void summon_event(int delay, EventType event_type = EventType::NOTHING);
+  void check_random_event();
+  void check_pending_assassins();
+  void print_players();
+  void init_server_objects();
+  bool hits_obstacle(Rectangle r);
+  bool bullet_hits(const Bullet &b);
+  bool raindrop_hits(const RainDrop &d);
+  void update_bullets(float dt);
+  void update_raindrops(float dt);
+  void remove_player(int id);
+  void remove_closed_clients();
+  void expire_sessions();
+  void check_heartbeats();
+  void publish_snapshot();
+  void take_udp();
+  void handle_packet(const client &from, const std::string &packet);
+  void server_tick(float dt);
+
+  Vector2 spawn_point() const;
+  bool is_ghost(int id) const { return ghost_players.count(id) != 0; }
+  void region_link(int side);
+  void region_message(int side, std::string &payload, int fd);
+  void apply_mirror(int side, std::map<std::string, netvent::Value> &data);
+  void drop_ghost_player(int id);
+  void hand_off_leavers();
+  void begin_player_handoff(int id, int side);
+  void finish_player_handoff(int id);
+  void restore_player(Handoff &h, int fd, const std::string &bytes);
+  client attach_player(int fd, int id, int version, uint32_t caps,
+                       const std::string &bytes);
+  void take_player(int side, const std::string &payload, int fd);
+  void send_region_chunk(const client &c, const std::vector<int> &known);
+  void send_mirrors();
 };
 
-static std::vector<Rectangle> bullet_colliders;
+// made once server_conf has been read, never resized after
+std::vector<std::unique_ptr<Room>> rooms;
+
+// the room a player id belongs to, nullptr for one no room hands out
+Room *room_of_id(int id) {
+  // a region server has one room, and players keep their ids when they
+  // cross into it from another region
+  if (region_links)
+    return id < 0 ? nullptr : rooms.front().get();
+  int index = id / ROOM_ID_SPAN - first_room;
+  if (id < 0 || index < 0 || index >= (int)rooms.size())
+    return nullptr;
+  return rooms[index].get();
+}
 
-std::mutex objects_mutex;
+// where a new connection goes: the first room with space, so rooms fill up
+// one at a time and stay dense. once every room is full the emptiest one
+// takes the overflow
+Room &pick_room() {
+  Room *emptiest = rooms.front().get();
+  for (auto &room : rooms) {
+    if (room->population < server_config.room_capacity)
+      return *room;
+    if (room->population < emptiest->population)
+      emptiest = room.get();
+  }
+  return *emptiest;
+}
 
-// Umbrella shooting cooldown system
-std::mutex umbrella_cooldown_mutex;
-std::map<int, std::chrono::steady_clock::time_point> umbrella_shoot_cooldowns;
-const float UMBRELLA_SHOOT_COOLDOWN = 0.15f; // 150ms between shots
+// regions hand bullets and raindrops to each other, so each one counts from
+// its own index in steps of the number of regions
+int Room::get_next_bullet_id() {
+    int id = current_bullet_id;
+    current_bullet_id += region_strip.count;
+    return id;
+}
+
+int Room::get_next_raindrop_id() {
+    int id = current_raindrop_id;
+    current_raindrop_id += region_strip.count;
+    return id;
+}
 
-void clear_assassin_state_unlocked() {
+void Room::clear_assassin_state() {
   std::cout << "Clearing assassin state" << std::endl;
 
   // reset assassin IDs
@@ -135,12 +544,6 @@ void clear_assassin_state_unlocked() {
   assassin_start_time = std::chrono::steady_clock::now();
 }
 
-void clear_assassin_state() {
-  std::scoped_lock all_locks(game_mutex, assassin_mutex, pending_assassin_mutex,
-                             clients_mutex);
-  clear_assassin_state_unlocked();
-}
-
 void perform_shutdown() {
   // try to exit gracefully
   try {
@@ -150,24 +553,12 @@ void perform_shutdown() {
       close_socket(server_socket_fd);
     }
 
-    // Clear any pending packets first
-    {
-      std::lock_guard<std::mutex> packets_lock(packets_mutex);
-      packets.clear();
-    }
-
-    // stop existing clients
-    {
-      std::scoped_lock lock(clients_mutex);
-      for (auto &[id, client_pair] : clients) {
-        if (client_pair.second && client_pair.second->joinable()) {
-          shutdown_socket(client_pair.first, SHUTDOWN_BOTH);
-          close_socket(client_pair.first);
-          client_pair.second->join();
-        }
-      }
-      clients.clear();
-    }
+    // stop existing clients, the reactor closes their sockets on exit
+    server_running = false;
+    if (reactor_thread.joinable())
+      reactor_thread.join();
+    for (auto &room : rooms)
+      room->clients.clear();
 
     std::cout << "Attempting graceful shutdown..." << std::endl;
     exit(0);
@@ -183,7 +574,7 @@ void shutdown_server(int signum) {
   server_running = false;
 }
 
-RainDrop raindrop_from_player(int player_id) {
+RainDrop Room::raindrop_from_player(int player_id) {
   RainDrop drop;
   
   // Only create raindrops for players with umbrella weapon
@@ -209,127 +600,71 @@ RainDrop raindrop_from_player(int player_id) {
   return drop;
 }
 
-void handle_client(int client, int id) {
-  try {
-    {
-      std::lock_guard<std::mutex> lock(game_mutex);
-      Player p(100, 100);
-      p.username = "unset";
-      p.color = RED;
-      game.players.insert({id, p});
-    }
-
-    std::ostringstream out;
-    {
-      std::scoped_lock lock(game_mutex, assassin_mutex);
-
-      for (auto &[k, v] : game.players) {
-        // sanitize
-        std::string safe_username = v.username;
-        if (safe_username.empty())
-          safe_username = "unset";
-        // remove bad characters
-        for (char &c : safe_username) {
-          if (c == ';' || c == ':' || c == ' ')
-            c = '_';
-        }
-
-        unsigned int color_code = color_to_uint(v.color);
-        if (k == assassin_id) {
-          color_code = color_to_uint(INVISIBLE);
-        }
-
-        out << ':' << k << ' ' << v.x << ' ' << v.y << ' ' << safe_username
-            << ' ' << color_code << ' ' << v.weapon_id;
-      }
-    }
-
-    std::string lod = "";
-    {
-      netvent::Table players_table = netvent::map_table({});
-      // get players in a table
-      for (auto &[k, v] : game.players) {
-        players_table.push_back(netvent::val(k), v.to_table(k));
-      }
-
-      EventType current_event = EventType::NOTHING;
-      bool assassin_active = assassin_id != -1;
-      if (darkness_active) {
-        current_event = EventType::Darkness;
-      } else if (acid_rain_active) {
-        current_event = EventType::AcidRain;
-      } else if (assassin_active) {
-        current_event = EventType::Assasin;
-      } 
-
-      std::map<std::string, netvent::Value> data = {
-          {"players", netvent::val(players_table)},
-          {"current_event", netvent::val(current_event)},
-          {"assassin_id", netvent::val(assassin_id)},
-          {"cubes", netvent::val(objects_to_table(cubes))}
-      };
-
-      lod = netvent::serialize_to_netvent(netvent::val(0 /* MSG_GAME_STATE */),
-                                          data);
-    }
-
-    send_message(lod, client);
-  } catch (const std::exception &e) {
-    std::cerr << "Client " << id << " error: " << e.what() << std::endl;
+JoinEvents Room::running_events() {
+  JoinEvents events;
+  events.darkness = darkness_active;
+  events.acid_rain = acid_rain_active;
+  events.swim = water_mode;
+  if (assassin_id != -1) {
+    events.assassin_id = assassin_id;
+    events.target_id = assassin_target_id;
   }
+  return events;
+}
 
-  std::string msg_id = netvent::serialize_to_netvent(
-      netvent::val(1 /* MSG_CLIENT_ID */),
-      std::map<std::string, netvent::Value>({{"id", netvent::val(id)}}));
-  send_message(msg_id, client);
-
-  std::cout << "Client " << msg_id << " has joined.\n";
-
-  // Send current event states to the new client
-  {
-    std::scoped_lock locks(darkness_mutex, acid_rain_mutex);
-
-    // Send darkness state if active
-    if (darkness_active) {
-      std::string event_msg = netvent::serialize_to_netvent(
-          netvent::val(MSG_EVENT_SUMMON),
-          std::map<std::string, netvent::Value>({
-              {"event_type", netvent::val(EventType::Darkness)}
-          }));
-      send_message(event_msg, client);
-      std::cout << "Sent darkness state to new client " << id << std::endl;
-    }
+CompressionStats compression_stats;
+
+// frames `payload`, compressed if it is at least compress_min_bytes and
+// that makes it smaller. only for connections that negotiated
+// CAP_COMPRESSION
+shared_frame make_compressed_frame(const std::string &payload) {
+  if (payload.size() < (size_t)server_config.compress_min_bytes)
+    return make_frame(payload);
+  auto start = std::chrono::steady_clock::now();
+  std::string packed = compress_message(payload);
+  std::chrono::duration<double> took =
+      std::chrono::steady_clock::now() - start;
+  compression_stats.add(std::atoi(payload.c_str()), payload.size(),
+                        packed.empty() ? payload.size() : packed.size(),
+                        took.count());
+  return make_frame(packed.empty() ? payload : packed);
+}
 
-    // send acid rain state if active
-    if (acid_rain_active) {
-      std::string event_msg = netvent::serialize_to_netvent(
-          netvent::val(MSG_EVENT_SUMMON),
-          std::map<std::string, netvent::Value>({
-              {"event_type", netvent::val(EventType::AcidRain)}
-          }));
-      send_message(event_msg, client);
-      std::cout << "Sent acid rain state to new client " << id << std::endl;
-    }
-  }
+// send_message, compressed where the connection allows
+void send_large_message(const std::string &msg, const client &c) {
+  if (c->caps & CAP_COMPRESSION)
+    c->reactor->send(c, make_compressed_frame(msg));
+  else
+    send_message(msg, c);
+}
 
-  // if there's an active assassin, send the assassin event message to the new
-  // client
-  {
-    std::lock_guard<std::mutex> assassin_lock(assassin_mutex);
-    if (assassin_id != -1 && assassin_target_id != -1) {
-      std::string event_msg = netvent::serialize_to_netvent(
-          netvent::val(MSG_ASSASSIN_CHANGE),
-          std::map<std::string, netvent::Value>({
-              {"assassin_id", netvent::val(assassin_id)},
-              {"target_id", netvent::val(assassin_target_id)}
-          }));
-      send_message(event_msg, client);
-      std::cout << "Sent assassin state to new client " << id << std::endl;
-    }
+// the client's id, the liveness timings and, if the connection uses them,
+// its session token and a fresh UDP token
+void send_client_id(const client &c, int session) {
+  std::map<std::string, netvent::Value> id_data = {
+      {"id", netvent::val((int)c->id)},
+      {"heartbeat_ms", netvent::val(server_config.heartbeat_interval_ms)},
+      {"idle_timeout_ms", netvent::val(server_config.idle_timeout_ms)}};
+  if (session != 0) {
+    id_data["session"] = netvent::val(session);
+    id_data["session_grace_ms"] = netvent::val(server_config.session_grace_ms);
   }
+  if (udp.is_open() && (c->caps & CAP_UDP_MOVEMENT))
+    id_data["udp_token"] = netvent::val((int)udp.expect(c->id));
+  if (udp_port != UDP_PORT)
+    id_data["udp_port"] = netvent::val(udp_port);
+  // where to ask for the session back, players move between regions
+  if (region_links)
+    id_data["region"] = netvent::val(region_strip.index);
+  send_message(netvent::serialize_to_netvent(
+                   netvent::val(1 /* MSG_CLIENT_ID */), id_data),
+               c);
+}
 
+// MSG_PLAYER_NEW, telling clients about a player they have not seen yet
+std::string player_new_message(int id, const Player &p) {
   // sanitize username for consistency
-  std::string safe_username = game.players.at(id).username;
+  std::string safe_username = p.username;
   if (safe_username.empty())
     safe_username = "unset";
   // remove bad characters
@@ -338,77 +673,323 @@ void handle_client(int client, int id) {
       c = '_';
   }
 
-  std::string out = netvent::serialize_to_netvent(
+  return netvent::serialize_to_netvent(
       netvent::val(3 /* MSG_PLAYER_NEW */),
       std::map<std::string, netvent::Value>(
           {{"id", netvent::val(id)},
-           {"x", netvent::val(game.players.at(id).x)},
-           {"y", netvent::val(game.players.at(id).y)},
+           {"x", netvent::val(p.x)},
+           {"y", netvent::val(p.y)},
            {"username", netvent::val(safe_username)},
-           {"color", netvent::val(color_to_table(game.players.at(id).color))},
-           {"weapon_id", netvent::val(game.players.at(id).weapon_id)}}));
+           {"color", netvent::val(color_to_table(p.color))},
+           {"weapon_id", netvent::val(p.weapon_id)}}));
+}
 
-  {
-    std::lock_guard<std::mutex> clients_lock(clients_mutex);
-    for (auto &pair : clients) {
-      if (pair.first != id) {
-        send_message(out, pair.second.first);
-      }
-    }
+// last step of a join, once the client has the other players and the map:
+// its player enters the simulation and everyone is told about it
+void Room::go_live(const client &c) {
+  int id = c->id;
+
+  try {
+    Vector2 spawn = spawn_point();
+    Player p(spawn.x, spawn.y);
+    p.username = "unset";
+    p.color = RED;
+    game.players.insert_or_assign(id, p);
+
+    // its own player and the running events. everyone else and the map
+    // went out in earlier chunks
+    std::string lod =
+        join_snapshot.final_chunk(id, game.players.at(id), running_events());
+    send_large_message(lod, c);
+  } catch (const std::exception &e) {
+    std::cerr << "Client " << id << " error: " << e.what() << std::endl;
   }
 
-  bool running;
-  {
-    std::lock_guard<std::mutex> _(running_mutex);
-    running = is_running[id];
+  int token = 0;
+  if (c->caps & CAP_RESUME) {
+    token = std::uniform_int_distribution<int>(1, INT_MAX)(session_rng);
+    sessions[id] = {token, c, {}};
   }
+  send_client_id(c, token);
 
-  while (running) {
-    char buffer[1024];
+  std::cout << "Client " << id << " has joined.\n";
 
-    int received = recv_data(client, buffer, sizeof(buffer), 0);
+  broadcast_message(player_new_message(id, game.players.at(id)), clients, id);
+}
 
-    if (received <= 0)
-      break;
-    {
-      std::lock_guard<std::mutex> _(running_mutex);
-      running = is_running[id];
-    }
+// runs on the reactor thread once a connection is accepted. only places
+// it in a room and queues it there; the room's tick gives it an id, and
+// once the client has said hello the join itself is spread over the next
+// ticks by admit_joiners(), or its old session is resumed
+void admit_client(const client &c) {
+  c->last_heard = std::chrono::steady_clock::now().time_since_epoch().count();
+  Room &room = pick_room();
+  room.population++;
+  c->room = room.index;
+  room.admit(c);
+}
 
-    if (!running)
-      break;
+void Room::admit(const client &c) {
+  std::lock_guard<std::mutex> lock(admission_mutex);
+  admission_queue.push_back(c);
+}
 
-    {
-      std::lock_guard<std::mutex> lock(packets_mutex);
-      packets.push_front({
-          id,
-          std::string(buffer, received),
-      });
+// reserves the lowest free id in the room for a connection in the
+// admission queue. a region server goes round its ids instead: its players
+// keep their ids when they cross into another region, so one that left
+// here may still be in use next door
+void Room::assign_id(const client &c) {
+  auto taken = [&](int id) {
+    return game.players.count(id) || clients.count(id) ||
+           leaving_ids.count(id) || joining_ids.count(id);
+  };
+  int id = id_base;
+  if (region_links) {
+    do {
+      id = id_base + id_cursor;
+      id_cursor = (id_cursor + 1) % ROOM_ID_SPAN;
+    } while (taken(id));
+  }
+  while (taken(id))
+    id++;
+  c->id = id;
+  joining_ids.insert(id);
+}
+
+// where new players appear: the top left of the map, or the top middle of
+// a region's strip
+Vector2 Room::spawn_point() const {
+  if (!region_links)
+    return {100, 100};
+  return {region_strip.center() - 50, 100};
+}
+
+void Room::start_join(const client &c) {
+  Joiner j;
+  j.c = c;
+  joining_ids.erase(c->id);
+  clients[c->id] = c;
+
+  Vector2 spawn = spawn_point();
+  for (auto &[id, p] : game.players)
+    j.players.push_back(id);
+  auto distance = [&](int id) {
+    const Player &p = game.players.at(id);
+    return Vector2Distance(spawn, {(float)p.x, (float)p.y});
+  };
+  std::sort(j.players.begin(), j.players.end(),
+            [&](int a, int b) { return distance(a) > distance(b); });
+  joining.push_back(std::move(j));
+}
+
+// queues the joiner's next chunk: the nearest players first, then the map.
+// true once there is nothing left to send
+bool Room::send_join_chunk(Joiner &j) {
+  if (!j.players.empty()) {
+    size_t n = std::min(j.players.size(),
+                        (size_t)server_config.join_chunk_players);
+    std::vector<int> ids(j.players.end() - n, j.players.end());
+    j.players.resize(j.players.size() - n);
+    std::reverse(ids.begin(), ids.end());
+
+    std::string chunk = join_snapshot.players_chunk(ids, game.players);
+    if (!chunk.empty())
+      send_large_message(chunk, j.c);
+  } else if (!j.sent_map) {
+    if (j.c->caps & CAP_COMPRESSION) {
+      // compressed once, like the plain map frame
+      if (!compressed_map)
+        compressed_map = make_compressed_frame(join_snapshot.map_text(cubes));
+      j.c->reactor->send(j.c, compressed_map);
+    } else {
+      j.c->reactor->send(j.c, join_snapshot.map_chunk(cubes));
     }
+    j.sent_map = true;
+  } else {
+    return true;
+  }
+  return false;
+}
+
+// answers a hello with the protocol version and capabilities the connection
+// will use. false if the two sides have no version in common, the
+// connection is then closed
+bool welcome(const client &c, const Hello &hello) {
+  Negotiated n =
+      negotiate(hello.version, hello.caps, server_config.capabilities);
+  if (!n.ok()) {
+    std::cout << "Client " << c->id << " speaks protocol " << hello.version
+              << ", closing" << std::endl;
+    reactor->close(c);
+    return false;
   }
+  c->version = n.version;
+  c->caps = n.caps;
+  c->welcomed.store(true, std::memory_order_release);
+  send_message(netvent::serialize_to_netvent(
+                   netvent::val(MSG_WELCOME),
+                   std::map<std::string, netvent::Value>(
+                       {{"version", netvent::val(n.version)},
+                        {"caps", netvent::val((int)n.caps)}})),
+               c);
+  return true;
+}
+
+// hands a reconnected client its old player back. only what changed since
+// the tick the client last heard of is sent, not the whole game state, along
+// with the bullets and raindrops in flight, which the client dropped. false
+// if the session is unknown or expired or the client is too far behind for
+// a delta, it then joins as a new player
+bool Room::resume_session(const client &c, const Hello &hello) {
+  auto it = sessions.find(hello.id);
+  if (it == sessions.end() || it->second.token != hello.session ||
+      !join_snapshot.can_resume_from(hello.tick))
+    return false;
+  Session &s = it->second;
+  // the old connection may not have noticed yet that it is dead. its close
+  // is ignored once `clients` points at the new one
+  if (s.c)
+    reactor->close(s.c);
+  s.c = c;
+
+  joining_ids.erase(c->id);
+  c->id = hello.id;
+  clients[hello.id] = c;
+  std::string delta =
+      join_snapshot.resume_chunk(hello.tick, game.players, running_events());
+  WorldUpdate in_flight;
+  delta += in_flight_lines(in_flight);
+  send_large_message(delta, c);
+  send_client_id(c, s.token);
+  std::cout << "Client " << hello.id << " resumed from tick " << hello.tick
+            << std::endl;
+  return true;
+}
 
+// at most max_concurrent_joins clients are being sent state at a time, one
+// chunk each per tick, so a burst of joins costs the players already in the
+// match about the same every tick instead of one long stall. resumes are a
+// single message and are never held back
+void Room::admit_joiners() {
+  auto now = std::chrono::steady_clock::now();
+  auto hello_timeout =
+      std::chrono::milliseconds(server_config.hello_timeout_ms);
   {
-    std::lock_guard<std::mutex> _(running_mutex);
-    is_running[id] = false;
-    std::lock_guard<std::mutex> _lock(game_mutex);
-    game.players.erase(id);
-
-    // Check if disconnected player was assassin
-    std::lock_guard<std::mutex> assassin_lock(assassin_mutex);
-    if (id == assassin_id) {
-      std::cout << "Assassin (ID: " << id
-                << ") disconnected. Ending assassin event." << std::endl;
-      if (game.players.count(id)) {
-        game.players.at(id).color = original_assassin_color;
-        std::ostringstream response;
-        response << "5\n" // MSG_PLAYER_UPDATE
-                 << id << " " << game.players.at(id).username << " "
-                 << color_to_uint(original_assassin_color);
-        broadcast_message(response.str(), clients);
+    std::lock_guard<std::mutex> lock(admission_mutex);
+    for (auto it = admission_queue.begin(); it != admission_queue.end();) {
+      const client &c = *it;
+      if (c->closing) {
+        // its close may have been seen before it had an id
+        joining_ids.erase(c->id);
+        hellos.erase(c->id);
+        it = admission_queue.erase(it);
+        continue;
       }
-      clear_assassin_state_unlocked();
+      if (c->id == -1)
+        assign_id(c);
+
+      auto hello = hellos.find(c->id);
+      if (hello == hellos.end()) {
+        std::chrono::steady_clock::time_point heard{
+            std::chrono::steady_clock::duration(c->last_heard.load())};
+        if (now - heard <= hello_timeout) {
+          ++it;
+          continue;
+        }
+        // built before the handshake: version 0, which welcome() turns away
+        hello = hellos.emplace(c->id, Hello()).first;
+      }
+
+      Hello &h = hello->second;
+      if (!h.welcomed) {
+        if (!welcome(c, h)) {
+          hellos.erase(hello);
+          ++it; // leaves the queue once the close has gone through
+          continue;
+        }
+        h.welcomed = true;
+      }
+      Room *home = room_of_id(h.id);
+      if (home && home != this && (c->caps & CAP_RESUME)) {
+        // its player is in another room, which takes the connection over
+        hand_off(c, h, *home);
+        hellos.erase(hello);
+        it = admission_queue.erase(it);
+        continue;
+      }
+      if (h.id != -1 && (c->caps & CAP_RESUME)) {
+        if (resume_session(c, h)) {
+          hellos.erase(hello);
+          it = admission_queue.erase(it);
+          continue;
+        }
+        h.id = -1; // joins as a new player instead
+      }
+      if (joining.size() >= (size_t)server_config.max_concurrent_joins) {
+        ++it;
+        continue;
+      }
+      hellos.erase(hello);
+      start_join(c);
+      it = admission_queue.erase(it);
+    }
+  }
+
+  for (auto it = joining.begin(); it != joining.end();) {
+    if (it->c->closing) {
+      it = joining.erase(it);
+    } else if (send_join_chunk(*it)) {
+      go_live(it->c);
+      it = joining.erase(it);
+    } else {
+      ++it;
     }
   }
+}
+
+// moves a connection that wants to resume a player in room `to` there. the
+// hello has been answered already, `to` goes on from the resume. does
+// nothing if the connection has been closed in the meantime, its close then
+// went to this room
+bool Room::hand_off(const client &c, const Hello &hello, Room &to) {
+  joining_ids.erase(c->id);
+  int from = index;
+  if (!c->room.compare_exchange_strong(from, to.index))
+    return false;
+  population--;
+  to.population++;
+  to.tick_inbox.post([&to, c, hello] { to.adopt(c, hello); });
+  return true;
+}
+
+void Room::adopt(const client &c, const Hello &hello) {
+  if (c->closing)
+    return;
+  assign_id(c);
+  hellos[c->id] = hello;
+  admit(c);
+}
+
+void Room::closed(const client &c) {
+  std::lock_guard<std::mutex> lock(closed_mutex);
+  closed_clients.push_back(c);
+}
+
+// runs on the reactor thread after the socket has been closed
+void on_client_closed(const client &c) {
+  // a connection being handed to another region is left to the handoff,
+  // which finds out when the reactor gives the socket up
+  int r = c->room;
+  do {
+    if (r < 0)
+      return;
+  } while (!c->room.compare_exchange_weak(r, -1));
+  rooms[r]->population--;
+  int id = c->id;
+  if (id == -1)
+    return;
+
+  rooms[r]->closed(c);
 
   std::cout << "Client " << id << " disconnected.\n";
 }
@@ -426,8 +1007,9 @@ float normalize_rotation(float rot) {
 //  EVENTS
 // ---------------------------------
 
-bool check_assassin_collision(int assassin_id, int target_id, int assassin_x,
-                              int assassin_y, float assassin_rot) {
+bool Room::check_assassin_collision(int assassin_id, int target_id,
+                                    int assassin_x, int assassin_y,
+                                    float assassin_rot) {
   if (assassin_id == -1 || target_id == -1)
     return false;
 
@@ -466,14 +1048,16 @@ bool check_assassin_collision(int assassin_id, int target_id, int assassin_x,
   return distance <= hitbox_radius;
 }
 
-void select_new_target(int assassin_id, bool is_initial_target) {
+void Room::select_new_target(int assassin_id, bool is_initial_target) {
   std::vector<int> potential_targets;
   for (const auto &[player_id, player] : game.players) {
     // don't target:
     // - the assassin themselves
     // - invisible players
     // - previously targeted players (unless we've targeted everyone)
-    if (player_id != assassin_id && !color_equal(player.color, INVISIBLE) &&
+    // - players another region owns
+    if (player_id != assassin_id && !is_ghost(player_id) &&
+        !color_equal(player.color, INVISIBLE) &&
         (previous_targets.find(player_id) == previous_targets.end() ||
          previous_targets.size() >= game.players.size() - 1)) {
       potential_targets.push_back(player_id);
@@ -508,7 +1092,7 @@ void select_new_target(int assassin_id, bool is_initial_target) {
 
     auto assassin_client = clients.find(assassin_id);
     if (assassin_client != clients.end()) {
-      send_message(event_response, assassin_client->second.first);
+      send_message(event_response, assassin_client->second);
       if (is_initial_target) {
         std::cout << "New assassin " << assassin_id
                   << " assigned initial target " << assassin_target_id
@@ -521,10 +1105,7 @@ void select_new_target(int assassin_id, bool is_initial_target) {
   }
 }
 
-void make_player_assassin(int target_id) {
-  std::scoped_lock all_locks(game_mutex, assassin_mutex, pending_assassin_mutex,
-                             clients_mutex);
-
+void Room::make_player_assassin(int target_id) {
   if (assassin_id != -1) {
     std::cout << "Command failed: An assassin event is already active."
               << std::endl;
@@ -537,6 +1118,12 @@ void make_player_assassin(int target_id) {
     return;
   }
 
+  if (is_ghost(target_id)) {
+    std::cout << "Command failed: Player " << target_id
+              << " is in another region." << std::endl;
+    return;
+  }
+
   // prevent consecutive assassin roles
   if (target_id == last_assassin_id) {
     std::cout << "Player " << target_id << " was the last assassin. Skipping."
@@ -571,7 +1158,7 @@ void make_player_assassin(int target_id) {
   broadcast_message(res, clients);
 }
 
-void summon_event(int delay, EventType event_type = EventType::NOTHING) {
+void Room::summon_event(int delay, EventType event_type) {
   if (delay <= 70 && event_type == EventType::NOTHING) {
     return; // too short to summon an event (only applies to random events)
   }
@@ -581,7 +1168,6 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
 
   switch (event_type) {
   case EventType::Darkness: {
-    std::scoped_lock locks(darkness_mutex, clients_mutex);
     if (!darkness_active) {
       darkness_active = true;
       darkness_start_time = std::chrono::steady_clock::now();
@@ -596,32 +1182,30 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
   }
   case EventType::Assasin: {
     int target_id = -1;
-    {
-      std::lock_guard<std::mutex> game_lock(game_mutex);
-      if (game.players.empty() || game.players.size() <= 2) {
-        std::cout << "Not enough players to start an assassin event."
-                  << std::endl;
-        break;
-      }
+    if (game.players.empty() || game.players.size() <= 2) {
+      std::cout << "Not enough players to start an assassin event."
+                << std::endl;
+      break;
+    }
 
-      if (used_assassin_ids.size() >= game.players.size()) {
-        std::cout << "All players have been assassins. Resetting assassin pool."
-                  << std::endl;
-        used_assassin_ids.clear();
-      }
+    if (used_assassin_ids.size() >= game.players.size()) {
+      std::cout << "All players have been assassins. Resetting assassin pool."
+                << std::endl;
+      used_assassin_ids.clear();
+    }
 
-      // find a player who hasn't been an assassin yet
-      std::vector<int> available_players;
-      for (const auto &player : game.players) {
-        if (used_assassin_ids.find(player.first) == used_assassin_ids.end()) {
-          available_players.push_back(player.first);
-        }
+    // find a player who hasn't been an assassin yet
+    std::vector<int> available_players;
+    for (const auto &player : game.players) {
+      if (used_assassin_ids.find(player.first) == used_assassin_ids.end() &&
+          !is_ghost(player.first)) {
+        available_players.push_back(player.first);
       }
+    }
 
-      if (!available_players.empty()) {
-        int random_index = random_int(0, available_players.size() - 1);
-        target_id = available_players[random_index];
-      }
+    if (!available_players.empty()) {
+      int random_index = random_int(0, available_players.size() - 1);
+      target_id = available_players[random_index];
     }
 
     if (target_id != -1) {
@@ -630,7 +1214,6 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
     break;
   }
   case EventType::Clear: {
-    std::scoped_lock locks(darkness_mutex, clients_mutex);
     if (darkness_active) {
       darkness_active = false;
     }
@@ -640,7 +1223,6 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
     break;
   }
   case EventType::AcidRain: {
-    std::scoped_lock locks(acid_rain_mutex, clients_mutex);
     std::cout << "Acid rain event started" << std::endl;
     if (!acid_rain_active) {
       acid_rain_active = true;
@@ -653,7 +1235,6 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
     break;
   }
   case EventType::Swim: {
-    std::scoped_lock locks(swim_mutex, clients_mutex);
     if (!water_mode) {
       water_mode = true;
 
@@ -665,66 +1246,60 @@ void summon_event(int delay, EventType event_type = EventType::NOTHING) {
 };
 }
 
-void event_worker() {
-  std::random_device rd;
-  std::mt19937 rng(rd());
-  std::uniform_int_distribution<int> dist(0, 5 * 60 * 1000); // 0 to 5 min in ms
-
-  while (true) {
-    int delay = dist(rng); // pick when in the next 5 minutes to run
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-    summon_event(delay); // run at some point within the 5 min window
-
-    int remaining = (5 * 60 * 1000) - delay;
-    std::this_thread::sleep_for(std::chrono::milliseconds(remaining));
+// runs a random event at some point within every 5 min window. checked
+// every tick, so a room needs no thread of its own for it
+void Room::check_random_event() {
+  const auto window = std::chrono::minutes(5);
+  auto now = std::chrono::steady_clock::now();
+  if (event_window == std::chrono::steady_clock::time_point() ||
+      now - event_window >= window) {
+    event_window = now;
+    // pick when in the next 5 minutes to run
+    event_delay = std::uniform_int_distribution<int>(0, 5 * 60 * 1000)(
+        event_rng);
+  }
+  if (event_delay >= 0 &&
+      now - event_window >= std::chrono::milliseconds(event_delay)) {
+    summon_event(event_delay);
+    event_delay = -1;
   }
 }
 
-void check_pending_assassins() {
-  std::scoped_lock all_locks(game_mutex, assassin_mutex, pending_assassin_mutex,
-                             clients_mutex);
-
+void Room::check_pending_assassins() {
   // check darkness event timeout (1 minute)
-  {
-    std::lock_guard<std::mutex> darkness_lock(darkness_mutex);
-    if (darkness_active) {
-      auto current_time = std::chrono::steady_clock::now();
-      auto darkness_duration = std::chrono::duration_cast<std::chrono::seconds>(
-                                   current_time - darkness_start_time)
-                                   .count();
+  if (darkness_active) {
+    auto current_time = std::chrono::steady_clock::now();
+    auto darkness_duration = std::chrono::duration_cast<std::chrono::seconds>(
+                                 current_time - darkness_start_time)
+                                 .count();
 
-      if (darkness_duration >= 60) {
-        darkness_active = false;
+    if (darkness_duration >= 60) {
+      darkness_active = false;
 
-        // send clear event message to all clients
-        std::string res = netvent::serialize_to_netvent(netvent::val(MSG_EVENT_SUMMON), std::map<std::string, netvent::Value>({{"event_type", netvent::val(EventType::Clear)}}));
-        broadcast_message(res, clients);
+      // send clear event message to all clients
+      std::string res = netvent::serialize_to_netvent(netvent::val(MSG_EVENT_SUMMON), std::map<std::string, netvent::Value>({{"event_type", netvent::val(EventType::Clear)}}));
+      broadcast_message(res, clients);
 
-        std::cout << "Darkness event ended after 60 seconds" << std::endl;
-      }
+      std::cout << "Darkness event ended after 60 seconds" << std::endl;
     }
   }
 
   // also check acid rain event timeout (1 minute)
-  {
-    std::lock_guard<std::mutex> acid_rain_lock(acid_rain_mutex);
-    if (acid_rain_active) {
-      auto current_time = std::chrono::steady_clock::now();
-      auto acid_rain_duration =
-          std::chrono::duration_cast<std::chrono::seconds>(current_time -
-                                                           acid_rain_start_time)
-              .count();
+  if (acid_rain_active) {
+    auto current_time = std::chrono::steady_clock::now();
+    auto acid_rain_duration =
+        std::chrono::duration_cast<std::chrono::seconds>(current_time -
+                                                         acid_rain_start_time)
+            .count();
 
-      if (acid_rain_duration >= 60) {
-        acid_rain_active = false;
+    if (acid_rain_duration >= 60) {
+      acid_rain_active = false;
 
-        // send clear event message to all clients
-        std::string res = netvent::serialize_to_netvent(netvent::val(MSG_EVENT_SUMMON), std::map<std::string, netvent::Value>({{"event_type", netvent::val(EventType::Clear)}}));
-        broadcast_message(res, clients);
+      // send clear event message to all clients
+      std::string res = netvent::serialize_to_netvent(netvent::val(MSG_EVENT_SUMMON), std::map<std::string, netvent::Value>({{"event_type", netvent::val(EventType::Clear)}}));
+      broadcast_message(res, clients);
 
-        std::cout << "Acid rain event ended after 60 seconds" << std::endl;
-      }
+      std::cout << "Acid rain event ended after 60 seconds" << std::endl;
     }
   }
 
@@ -744,7 +1319,7 @@ void check_pending_assassins() {
 
         broadcast_message(res, clients);
       }
-      clear_assassin_state_unlocked();
+      clear_assassin_state();
       return;
     }
   }
@@ -781,7 +1356,103 @@ void check_pending_assassins() {
 // END EVENTS
 // ---------------------------------
 
+// how long a console command waits for the ticks to answer with snapshots
+// before it makes do with older ones
+const std::chrono::milliseconds SNAPSHOT_WAIT(500);
+
+// a fresh snapshot of every room, in room order. all rooms are asked
+// before any is waited on, so this takes about one tick however many rooms
+// there are, and never more than SNAPSHOT_WAIT
+std::vector<std::shared_ptr<const GameSnapshot>> fresh_snapshots() {
+  std::vector<uint64_t> tickets;
+  for (const auto &room : rooms)
+    tickets.push_back(room->snapshots.request());
+  auto deadline = std::chrono::steady_clock::now() + SNAPSHOT_WAIT;
+  std::vector<std::shared_ptr<const GameSnapshot>> out;
+  for (size_t i = 0; i < rooms.size(); i++)
+    out.push_back(rooms[i]->snapshots.wait(tickets[i], deadline));
+  return out;
+}
+
+// reads only counters and fresh snapshots, so it runs on the console thread
+// without touching the ticks
+void print_stats() {
+  uint64_t ticks = rooms.front()->tick_count;
+  uint64_t syscalls = reactor->io_syscalls;
+  std::cout << "backend " << reactor->name() << ", ticks " << ticks
+            << ", I/O syscalls " << syscalls << " ("
+            << (ticks ? (double)syscalls / ticks : 0.0)
+            << " per tick), bytes sent " << reactor->bytes_sent
+            << ", slow clients evicted " << reactor->evictions
+            << ", messages coalesced " << reactor->coalesced << std::endl;
+  std::map<std::string, int> by_caps;
+  for (const auto &snapshot : fresh_snapshots()) {
+    if (!snapshot)
+      continue;
+    for (const auto &c : snapshot->clients)
+      by_caps["v" + std::to_string(c.version) + " " +
+              capability_names(c.caps)]++;
+  }
+  uint64_t spilled = 0, dropped = 0;
+  for (const auto &room : rooms) {
+    spilled += room->inbound->spilled;
+    dropped += room->inbound->dropped;
+  }
+  for (const auto &[caps, n] : by_caps)
+    std::cout << "  " << n << " clients on " << caps << std::endl;
+  compression_stats.print(std::cout);
+  print_inbound_drops();
+  std::cout << "inbound queues: " << rooms.size() << " x "
+            << rooms.front()->inbound->capacity() << " slots, " << spilled
+            << " frames spilled, " << dropped << " dropped" << std::endl;
+  print_tick_stats();
+}
+
+// one line per room: its connections and the state after its last tick
+void print_rooms() {
+  auto snapshots = fresh_snapshots();
+  for (size_t i = 0; i < rooms.size(); i++) {
+    const auto &room = rooms[i];
+    std::cout << "room " << room->index << ": " << room->population
+              << " connections";
+    if (const auto &snapshot = snapshots[i])
+      std::cout << ", " << snapshot->players.size() << " players, tick "
+                << snapshot->tick;
+    std::cout << std::endl;
+  }
+}
+
+// lists the players as of the last tick
+void Room::print_players() {
+  uint64_t ticket = snapshots.request();
+  auto snapshot =
+      snapshots.wait(ticket, std::chrono::steady_clock::now() + SNAPSHOT_WAIT);
+  if (!snapshot)
+    return;
+  const JoinEvents &events = snapshot->events;
+  std::cout << "room " << index << ", tick " << snapshot->tick << ": " << snapshot->players.size()
+            << " players, " << snapshot->bullets.size() << " bullets, "
+            << snapshot->raindrops.size() << " raindrops"
+            << (events.darkness ? ", darkness" : "")
+            << (events.acid_rain ? ", acid rain" : "")
+            << (events.swim ? ", swim" : "") << std::endl;
+  for (const auto &[id, p] : snapshot->players) {
+    std::cout << "  " << id << " " << p.username << " at " << p.x << ","
+              << p.y;
+    if (id == events.assassin_id)
+      std::cout << " (assassin)";
+    else if (id == events.target_id)
+      std::cout << " (target)";
+    std::cout << std::endl;
+  }
+}
+
+// commands that change the game only post to the tick of the room they
+// are for, which owns everything they touch. the ones that just look ask
+// them for snapshots. game commands go to the room picked with "room N",
+// room 0 to begin with
 void handle_stdin_commands() {
+  Room *room = rooms.front().get();
   std::string line;
   while (std::getline(std::cin, line)) {
     std::istringstream iss(line);
@@ -794,64 +1465,40 @@ void handle_stdin_commands() {
         std::cout << "Usage: assassin <player_id>" << std::endl;
         continue;
       }
-      make_player_assassin(target_id);
+      room->tick_inbox.post(
+          [room, target_id] { room->make_player_assassin(target_id); });
     } else if (command == "darkness") {
-      summon_event(0, EventType::Darkness);
+      room->tick_inbox.post(
+          [room] { room->summon_event(0, EventType::Darkness); });
     } else if (command == "clear") {
-      summon_event(0, EventType::Clear);
+      room->tick_inbox.post(
+          [room] { room->summon_event(0, EventType::Clear); });
     } else if (command == "acid_rain") {
-      summon_event(0, EventType::AcidRain);
+      room->tick_inbox.post(
+          [room] { room->summon_event(0, EventType::AcidRain); });
     } else if (command == "swim") {
-      summon_event(0, EventType::Swim);
-    } else {
-      std::cout << "Unknown command: " << command << std::endl;
-    }
-  }
-}
-
-void accept_clients(int sock) {
-  while (server_running) {
-    int client = accept_connection(sock, nullptr, nullptr);
-    if (!server_running)
-      break;
-
-    if (client < 0) {
-      if (errno != EINTR) {
-        perror("Accept failed");
-      }
-      continue;
-    }
-
-    int id = 0;
-    while (server_running) {
-      int id_init = id;
-      {
-        std::lock_guard<std::mutex> game_lock(game_mutex);
-        for (auto &[k, v] : game.players)
-          if (id == k)
-            id++;
+      room->tick_inbox.post(
+          [room] { room->summon_event(0, EventType::Swim); });
+    } else if (command == "room") {
+      size_t index;
+      if (!(iss >> index) || index >= rooms.size()) {
+        std::cout << "Usage: room <0-" << rooms.size() - 1 << ">" << std::endl;
+        continue;
       }
-
-      if (id_init == id)
-        break;
-    }
-
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    if (server_running) {
-      clients[id] = std::make_pair(
-          client, std::make_shared<std::thread>(handle_client, client, id));
-
-      std::lock_guard<std::mutex> _(running_mutex);
-      is_running[id] = true;
+      room = rooms[index].get();
+    } else if (command == "rooms") {
+      print_rooms();
+    } else if (command == "stats") {
+      print_stats();
+    } else if (command == "players") {
+      room->print_players();
     } else {
-      close_socket(client);
+      std::cout << "Unknown command: " << command << std::endl;
     }
   }
 }
 
-void init_server_objects() {
-  std::lock_guard<std::mutex> lock(objects_mutex);
-
+void Room::init_server_objects() {
   // Initialize basic map objects without textures since server doesn't render
   const int BARREL_SIZE = 50;
   const int BARREL_COLLISION_SIZE = BARREL_SIZE * 2;
@@ -889,140 +1536,1813 @@ void init_server_objects() {
                            WHITE, ObjectType::Charger));
 }
 
-void update_bullets() {
-  std::scoped_lock locks(game_mutex, clients_mutex, objects_mutex);
+// whether `r` overlaps a barrel, charger or cube
+bool Room::hits_obstacle(Rectangle r) {
+  for (auto &obj : objects) {
+    if (obj.check_collision(r))
+      return true;
+  }
+  for (auto &cube : cubes) {
+    if (cube.check_collision(r))
+      return true;
+  }
+  return false;
+}
 
-  auto it = game.bullets.begin();
-  while (it != game.bullets.end()) {
-    bool should_despawn = false;
+// whether a bullet that has just moved hits the edge of the map, a player
+// other than its shooter or an obstacle. reads only, so it is safe to call
+// for many bullets at once
+bool Room::bullet_hits(const Bullet &b) {
+  if (b.x < 0 || b.x > PLAYING_AREA.width || b.y < 0 ||
+      b.y > PLAYING_AREA.height)
+    return true;
 
-    // Move bullet
-    it->move();
+  Rectangle bullet_rect = {(float)b.x, (float)b.y, b.r * 2, b.r * 2};
+  for (const auto &[player_id, player] : game.players) {
+    if (player_id == b.shotby_id)
+      continue;
 
-    // Check map boundaries
-    if (it->x < 0 || it->x > PLAYING_AREA.width || it->y < 0 ||
-        it->y > PLAYING_AREA.height) {
-      should_despawn = true;
-    }
+    Rectangle player_rect = {(float)player.x, (float)player.y, 100, 100};
+    if (CheckCollisionRecs(bullet_rect, player_rect))
+      return true;
+  }
+  return hits_obstacle(bullet_rect);
+}
 
-    // check player collisions
-    if (!should_despawn) {
-      Rectangle bullet_rect = {(float)it->x, (float)it->y, it->r * 2,
-                               it->r * 2};
+// the same for a raindrop. only shot raindrops hit obstacles
+bool Room::raindrop_hits(const RainDrop &d) {
+  if (d.position.x < -50 || d.position.x > PLAYING_AREA.width + 50 ||
+      d.position.y < -50 || d.position.y > PLAYING_AREA.height + 50)
+    return true;
+  if (d.rot == 0)
+    return false;
 
-      for (const auto &[player_id, player] : game.players) {
-        if (player_id == it->shotby_id)
-          continue;
+  Rectangle drop_rect = {d.position.x - d.size, d.position.y - d.size,
+                         d.size * 2, d.size * 2};
+  return hits_obstacle(drop_rect);
+}
 
-        Rectangle player_rect = {(float)player.x, (float)player.y, 100, 100};
-        if (CheckCollisionRecs(bullet_rect, player_rect)) {
-          should_despawn = true;
-          break;
-        }
-      }
+// bullets and raindrops are moved and tested split over the job threads,
+// each piece writing only its own entities and despawn flags. the despawns
+// are then applied on the tick thread in index order, so the world update
+// lists them in the same order however the work was split
+void Room::update_bullets(float dt) {
+  auto &bullets = game.bullets;
+  despawn_flags.assign(bullets.size(), 0);
+  jobs->parallel_for(0, bullets.size(), server_config.parallel_grain,
+                     [&](size_t lo, size_t hi) {
+                       for (size_t i = lo; i < hi; i++) {
+                         bullets[i].move(dt);
+                         despawn_flags[i] = bullet_hits(bullets[i]);
+                       }
+                     });
+
+  size_t kept = 0;
+  for (size_t i = 0; i < bullets.size(); i++) {
+    if (despawn_flags[i]) {
+      world_update.bullet_despawned(bullets[i].bullet_id);
+      continue;
     }
+    if (kept != i)
+      bullets[kept] = bullets[i];
+    kept++;
+  }
+  bullets.erase(bullets.begin() + kept, bullets.end());
+}
 
-    // Check collisions with map objects
-    if (!should_despawn) {
-      Rectangle bullet_rect = {(float)it->x, (float)it->y, it->r * 2,
-                               it->r * 2};
-      for (auto &obj : objects) {
-        if (obj.check_collision(bullet_rect)) {
-          should_despawn = true;
-          break;
-        }
-      }
-
-      for (auto &cube : cubes) {
-        if (cube.check_collision(bullet_rect)) {
-          should_despawn = true;
-          break;
-        }
-      }
+void Room::update_raindrops(float dt) {
+  auto &raindrops = game.raindrops;
+  despawn_flags.assign(raindrops.size(), 0);
+  jobs->parallel_for(0, raindrops.size(), server_config.parallel_grain,
+                     [&](size_t lo, size_t hi) {
+                       for (size_t i = lo; i < hi; i++) {
+                         RainDrop &d = raindrops[i];
+                         // move raindrop based on rotation
+                         if (d.rot != 0) {
+                           d.position.x += cosf(d.rot) * d.speed * dt;
+                           d.position.y += sinf(d.rot) * d.speed * dt;
+                         } else {
+                           d.position.y += d.speed * dt; // falling straight down
+                         }
+                         despawn_flags[i] = raindrop_hits(d);
+                       }
+                     });
+
+  size_t kept = 0;
+  for (size_t i = 0; i < raindrops.size(); i++) {
+    if (despawn_flags[i]) {
+      world_update.raindrop_despawned(raindrops[i].raindrop_id);
+      continue;
     }
+    if (kept != i)
+      raindrops[kept] = raindrops[i];
+    kept++;
+  }
+  raindrops.erase(raindrops.begin() + kept, raindrops.end());
+}
 
-    if (should_despawn) {
-      // Send despawn message to all clients
-      std::string msg = netvent::serialize_to_netvent(
-          netvent::val(MSG_BULLET_DESPAWN),
-          std::map<std::string, netvent::Value>({
-              {"bullet_id", netvent::val(it->bullet_id)}
-          }));
-      broadcast_message(msg, clients);
-
-      // Remove bullet
-      it = game.bullets.erase(it);
-    } else {
+// server_conf job_threads, or one per core
+int job_threads() {
+  if (server_config.job_threads > 0)
+    return server_config.job_threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// server_conf tick_threads, or one per core, but never more than there
+// are rooms to tick
+int tick_threads() {
+  int threads = server_config.tick_threads;
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  return std::min<int>(threads, rooms.size());
+}
+
+// server_conf rooms of them, all empty
+void make_rooms() {
+  rooms.clear();
+  for (int i = 0; i < std::max(1, server_config.rooms); i++)
+    rooms.push_back(std::make_unique<Room>(i));
+}
+
+// wires the chosen backend up to the rooms
+void attach_reactor() {
+  reactor->high_watermark = server_config.outbound_high_watermark;
+  reactor->low_watermark = server_config.outbound_low_watermark;
+  reactor->max_queued_bytes = server_config.outbound_max_bytes;
+  reactor->evict_after =
+      std::chrono::milliseconds(server_config.slow_client_timeout_ms);
+  reactor->on_accept = admit_client;
+  reactor->on_data = [](const client &c, const char *data, size_t len) {
+    int r = c->room;
+    if (r == ROOM_HANDED_OFF) {
+      // read by the next region, along with the rest of the socket
+      c->reader.append(data, len);
+      return;
+    }
+    if (r < 0)
+      return;
+    Room &room = *rooms[r];
+    c->reader.append(data, len);
+    c->last_heard = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto now = limiter_time(room.tick_count);
+    c->reader.max_frame = c->welcomed.load(std::memory_order_acquire)
+                              ? MAX_FRAME_SIZE
+                              : MAX_HELLO_SIZE;
+    std::string_view frame;
+    while (c->reader.next(frame)) {
+      int type = peek_message_type(frame);
+      if (!c->limiter.allow(type, now, server_config)) {
+        inbound_drops.count(type);
+        continue;
+      }
+      room.inbound->push(c, frame);
+    }
+    if (c->reader.corrupt) {
+      std::cerr << "Client " << c->id << " sent an oversized frame" << std::endl;
+      reactor->close(c);
+    } else if (c->limiter.flooding(now, server_config) && !c->closing) {
+      std::cerr << "Client " << c->id << " stayed over its rate limit"
+                << std::endl;
+      inbound_drops.disconnected++;
+      reactor->close(c);
+    }
+  };
+  reactor->on_close = on_client_closed;
+}
+
+// drops a player and lists it in this tick's world update
+void Room::remove_player(int id) {
+  leaving_ids.insert(id);
+  sessions.erase(id);
+  game.players.erase(id);
+  join_snapshot.forget(id);
+  world_update.player_left(id);
+
+  if (id == assassin_id) {
+    std::cout << "Assassin (ID: " << id
+              << ") disconnected. Ending assassin event." << std::endl;
+    clear_assassin_state();
+  }
+  std::cout << "Removed client " << id << std::endl;
+}
+
+// the reactor has already closed the sockets, so this only suspends the
+// sessions of live players and drops clients that were still joining.
+// nothing here waits on a socket, a thread or a timer
+void Room::remove_closed_clients() {
+  std::vector<client> closed;
+  {
+    std::lock_guard<std::mutex> lock(closed_mutex);
+    closed.swap(closed_clients);
+  }
+  if (closed.empty())
+    return;
+
+  auto expires = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(server_config.session_grace_ms);
+  for (const client &c : closed) {
+    int id = c->id;
+    joining_ids.erase(id);
+    hellos.erase(id);
+    auto it = clients.find(id);
+    if (it == clients.end() || it->second != c)
+      continue; // still waiting for admission, or already resumed elsewhere
+    clients.erase(it);
+    udp.forget(id);
+    udp_limiters.erase(id);
+
+    auto session = sessions.find(id);
+    if (session != sessions.end()) {
+      session->second.c = nullptr;
+      session->second.expires = expires;
+      std::cout << "Holding client " << id << " for "
+                << server_config.session_grace_ms << "ms" << std::endl;
+      continue;
+    }
+    remove_player(id);
+  }
+}
+
+// removes the players whose sessions were not resumed in time
+void Room::expire_sessions() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = sessions.begin(); it != sessions.end();) {
+    if (it->second.c || now < it->second.expires) {
       ++it;
+      continue;
     }
+    int id = it->first;
+    ++it; // remove_player() erases the session
+    remove_player(id);
   }
+
+  // a resuming client can be behind by the idle timeout as well as by the
+  // grace period, departures older than both are never asked for
+  join_snapshot.forget_departures(
+      now - std::chrono::milliseconds(server_config.idle_timeout_ms +
+                                      server_config.session_grace_ms));
 }
 
-void update_raindrops() {
-  std::scoped_lock locks(game_mutex, objects_mutex, clients_mutex);
+// once every heartbeat interval: sends every client a heartbeat and closes
+// the ones that have been silent for longer than idle_timeout_ms. the close
+// goes through the reactor like any other disconnect, so the player is
+// removed by remove_closed_clients() on the next tick
+void Room::check_heartbeats() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < next_heartbeat)
+    return;
+  next_heartbeat =
+      now + std::chrono::milliseconds(server_config.heartbeat_interval_ms);
 
-  auto it = game.raindrops.begin();
-  while (it != game.raindrops.end()) {
-    bool should_despawn = false;
+  // carries the tick so a client that hears nothing else still knows how
+  // far along it is when it resumes
+  shared_frame heartbeat = make_frame(netvent::serialize_to_netvent(
+      netvent::val(MSG_HEARTBEAT),
+      std::map<std::string, netvent::Value>(
+          {{"tick", netvent::val((int)tick_count)}})));
+  auto idle_timeout = std::chrono::milliseconds(server_config.idle_timeout_ms);
+
+  for (const auto &[id, c] : clients) {
+    std::chrono::steady_clock::time_point heard{
+        std::chrono::steady_clock::duration(c->last_heard.load())};
+    if (now - heard > idle_timeout) {
+      std::cout << "Client " << id << " timed out" << std::endl;
+      reactor->close(c);
+      continue;
+    }
+    reactor->send(c, heartbeat);
+  }
+}
 
-    // Move raindrop based on rotation
-    if (it->rot != 0) {
-      it->position.x += cosf(it->rot) * it->speed * 0.016f; // ~60fps
-      it->position.y += sinf(it->rot) * it->speed * 0.016f;
-    } else {
-      it->position.y += it->speed * 0.016f; // falling straight down
+// ---------------------------------
+//  REGIONS, see region.hpp
+// ---------------------------------
+
+// a player as Player::to_table() lists it. the Player constructor that
+// reads a table logs every call, which a mirror would do every tick
+Player player_from_table(netvent::Table &t) {
+  Player p(t[netvent::val("x")].as_int(), t[netvent::val("y")].as_int());
+  p.username = t[netvent::val("username")].as_string();
+  p.weapon_id = t[netvent::val("weapon_id")].as_int();
+  p.rot = t[netvent::val("rot")].as_float();
+  p.color = color_from_table(t[netvent::val("color")].as_table());
+  return p;
+}
+
+// bullets and raindrops as mirrors list them. velocities and angles are
+// scaled to ints, netvent keeps one decimal of a float
+netvent::Value bullet_entry(const Bullet &b) {
+  return netvent::val(netvent::arr_table(
+      {netvent::val(b.bullet_id), netvent::val(b.shotby_id), netvent::val(b.x),
+       netvent::val(b.y), netvent::val((int)(b.vel.x * 1000)),
+       netvent::val((int)(b.vel.y * 1000))}));
+}
+
+Bullet bullet_from_entry(const netvent::Value &entry) {
+  auto v = entry.as_table().get_data_vector();
+  return Bullet(v[2].as_int(), v[3].as_int(),
+                {v[4].as_int() / 1000.0f, v[5].as_int() / 1000.0f},
+                v[1].as_int(), v[0].as_int());
+}
+
+netvent::Value raindrop_entry(const RainDrop &d) {
+  return netvent::val(netvent::arr_table(
+      {netvent::val(d.raindrop_id), netvent::val((int)d.position.x),
+       netvent::val((int)d.position.y), netvent::val((int)d.speed),
+       netvent::val((int)d.size), netvent::val((int)(d.rot * 1000)),
+       netvent::val((int)(d.alpha * 100))}));
+}
+
+RainDrop raindrop_from_entry(const netvent::Value &entry) {
+  auto v = entry.as_table().get_data_vector();
+  RainDrop d;
+  d.raindrop_id = v[0].as_int();
+  d.position = {(float)v[1].as_int(), (float)v[2].as_int()};
+  d.speed = v[3].as_int();
+  d.size = v[4].as_int();
+  d.rot = v[5].as_int() / 1000.0f;
+  d.alpha = v[6].as_int() / 100.0f;
+  return d;
+}
+
+// the rotation a client's spawn_bullet() turns back into the bullet's
+// velocity, for bullets it is shown in flight rather than as they are shot
+float bullet_rot(const Bullet &b) {
+  return 5 - atan2f(b.vel.y, -b.vel.x) * RAD2DEG;
+}
+
+// `here` with every bullet and raindrop in flight, ghosts included, as the
+// key lines of a world update, for a client that has none of them
+std::string Room::in_flight_lines(WorldUpdate &here) {
+  for (const Bullet &b : game.bullets)
+    here.bullet_shot(b.shotby_id, b.bullet_id, b.x, b.y, bullet_rot(b));
+  for (auto &[id, g] : ghost_bullets)
+    here.bullet_shot(g.state.shotby_id, id, g.state.x, g.state.y,
+                     bullet_rot(g.state));
+  for (const RainDrop &d : game.raindrops)
+    here.raindrop_spawned(d);
+  for (auto &[id, g] : ghost_raindrops)
+    here.raindrop_spawned(g.state);
+  std::string lines = here.serialize(false, true, tick_count);
+  return lines.erase(0, lines.find('\n') + 1);
+}
+
+// a link that comes up has seen nothing and one that went down leaves
+// nothing valid, so either way what was mirrored from that side goes.
+// players on their way over there stay until their handoff is settled
+void Room::region_link(int side) {
+  std::vector<int> gone;
+  for (auto &[id, g] : ghost_players)
+    if (g.side == side && !handoffs.count(id))
+      gone.push_back(id);
+  for (int id : gone)
+    drop_ghost_player(id);
+
+  for (auto it = ghost_bullets.begin(); it != ghost_bullets.end();) {
+    if (it->second.side != side) {
+      ++it;
+      continue;
+    }
+    world_update.bullet_despawned(it->first);
+    it = ghost_bullets.erase(it);
+  }
+  for (auto it = ghost_raindrops.begin(); it != ghost_raindrops.end();) {
+    if (it->second.side != side) {
+      ++it;
+      continue;
+    }
+    world_update.raindrop_despawned(it->first);
+    it = ghost_raindrops.erase(it);
+  }
+  handed_bullets[side].clear();
+  handed_raindrops[side].clear();
+}
+
+void Room::region_message(int side, std::string &payload, int fd) {
+  int type = peek_message_type(payload);
+  if (type == REGION_PLAYER) {
+    take_player(side, payload, fd);
+    return;
+  }
+  if (fd != -1)
+    close_socket(fd);
+  if (type != REGION_MIRROR)
+    return;
+  try {
+    auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+    apply_mirror(side, data);
+  } catch (const std::exception &e) {
+    std::cerr << "Bad mirror from the " << RegionLinks::side_name(side)
+              << " region: " << e.what() << std::endl;
+  }
+}
+
+// takes over what the neighbour handed us, then makes the ghosts from that
+// side match its mirror: new ones are announced to our clients, changed
+// ones updated and the ones it no longer lists dropped
+void Room::apply_mirror(int side,
+                        std::map<std::string, netvent::Value> &data) {
+  auto list = [&](const char *key) {
+    auto it = data.find(key);
+    if (it == data.end())
+      return std::vector<netvent::Value>();
+    return it->second.as_table().get_data_vector();
+  };
+
+  for (const netvent::Value &entry : list("bullets_handed")) {
+    Bullet b = bullet_from_entry(entry);
+    game.bullets.push_back(b);
+    if (ghost_bullets.erase(b.bullet_id) == 0)
+      world_update.bullet_shot(b.shotby_id, b.bullet_id, b.x, b.y,
+                               bullet_rot(b));
+  }
+  for (const netvent::Value &entry : list("raindrops_handed")) {
+    RainDrop d = raindrop_from_entry(entry);
+    game.raindrops.push_back(d);
+    if (ghost_raindrops.erase(d.raindrop_id) == 0)
+      world_update.raindrop_spawned(d);
+  }
+
+  std::set<int> listed;
+  if (data.count("players")) {
+    for (auto &[key, value] : data["players"].as_table().get_data_map()) {
+      int id = key.as_int();
+      auto ours = game.players.find(id);
+      if (handoffs.count(id) || (ours != game.players.end() && !is_ghost(id)))
+        continue; // ours, a late mirror of it
+      Player p = player_from_table(value.as_table());
+      listed.insert(id);
+      auto g = ghost_players.find(id);
+      if (g == ghost_players.end()) {
+        ghost_players[id].side = side;
+        game.players[id] = p;
+        broadcast_message(player_new_message(id, p), clients);
+        world_update.player_moved(id, p.x, p.y, p.rot);
+        continue;
+      }
+      g->second.side = side;
+      g->second.held_until = 0;
+      Player &was = ours->second;
+      if (was.username != p.username || was.weapon_id != p.weapon_id ||
+          !color_equal(was.color, p.color))
+        broadcast_message(player_new_message(id, p), clients);
+      if (was.x != p.x || was.y != p.y || was.rot != p.rot)
+        world_update.player_moved(id, p.x, p.y, p.rot);
+      was = p;
     }
+  }
+  std::vector<int> gone;
+  for (auto &[id, g] : ghost_players)
+    if (g.side == side && !listed.count(id) && !handoffs.count(id) &&
+        g.held_until <= tick_count)
+      gone.push_back(id);
+  for (int id : gone)
+    drop_ghost_player(id);
+
+  std::set<int> listed_bullets;
+  for (const netvent::Value &entry : list("bullets")) {
+    Bullet b = bullet_from_entry(entry);
+    listed_bullets.insert(b.bullet_id);
+    auto g = ghost_bullets.find(b.bullet_id);
+    if (g == ghost_bullets.end())
+      world_update.bullet_shot(b.shotby_id, b.bullet_id, b.x, b.y,
+                               bullet_rot(b));
+    ghost_bullets[b.bullet_id] = {side, 0, b};
+  }
+  for (auto it = ghost_bullets.begin(); it != ghost_bullets.end();) {
+    if (it->second.side != side || listed_bullets.count(it->first) ||
+        it->second.held_until > tick_count) {
+      ++it;
+      continue;
+    }
+    world_update.bullet_despawned(it->first);
+    it = ghost_bullets.erase(it);
+  }
 
-    // Check map boundaries
-    if (it->position.x < -50 || it->position.x > PLAYING_AREA.width + 50 ||
-        it->position.y < -50 || it->position.y > PLAYING_AREA.height + 50) {
-      should_despawn = true;
+  std::set<int> listed_raindrops;
+  for (const netvent::Value &entry : list("raindrops")) {
+    RainDrop d = raindrop_from_entry(entry);
+    listed_raindrops.insert(d.raindrop_id);
+    auto g = ghost_raindrops.find(d.raindrop_id);
+    if (g == ghost_raindrops.end())
+      world_update.raindrop_spawned(d);
+    ghost_raindrops[d.raindrop_id] = {side, 0, d};
+  }
+  for (auto it = ghost_raindrops.begin(); it != ghost_raindrops.end();) {
+    if (it->second.side != side || listed_raindrops.count(it->first) ||
+        it->second.held_until > tick_count) {
+      ++it;
+      continue;
     }
+    world_update.raindrop_despawned(it->first);
+    it = ghost_raindrops.erase(it);
+  }
+}
 
-    // Check collisions with map objects (only for shot raindrops)
-    if (!should_despawn && it->rot != 0) {
-      Rectangle drop_rect = {it->position.x - it->size, it->position.y - it->size, 
-                            it->size * 2, it->size * 2};
-      
-      for (auto &obj : objects) {
-        if (obj.check_collision(drop_rect)) {
-          should_despawn = true;
-          break;
+void Room::drop_ghost_player(int id) {
+  ghost_players.erase(id);
+  game.players.erase(id);
+  join_snapshot.forget(id);
+  world_update.player_left(id);
+}
+
+// hands what has left the strip to the neighbour it went into. with that
+// neighbour down it stays ours, the whole map is simulated here anyway
+void Room::hand_off_leavers() {
+  std::vector<std::pair<int, int>> leaving;
+  for (auto &[id, c] : clients) {
+    auto p = game.players.find(id);
+    if (p == game.players.end() || is_ghost(id))
+      continue; // still joining
+    int side =
+        region_strip.beyond(p->second.x + 50, REGION_HANDOFF_MARGIN);
+    if (side != -1 && region_links->up(side))
+      leaving.push_back({id, side});
+  }
+  for (auto [id, side] : leaving)
+    begin_player_handoff(id, side);
+
+  uint64_t hold = tick_count + server_config.tick_rate;
+  auto &bullets = game.bullets;
+  size_t kept = 0;
+  for (size_t i = 0; i < bullets.size(); i++) {
+    int side = region_strip.beyond(bullets[i].x);
+    if (side != -1 && region_links->up(side)) {
+      // our clients keep it, from now on as a ghost
+      handed_bullets[side].push_back(bullet_entry(bullets[i]));
+      ghost_bullets[bullets[i].bullet_id] = {side, hold, bullets[i]};
+      continue;
+    }
+    if (kept != i)
+      bullets[kept] = bullets[i];
+    kept++;
+  }
+  bullets.erase(bullets.begin() + kept, bullets.end());
+
+  auto &raindrops = game.raindrops;
+  kept = 0;
+  for (size_t i = 0; i < raindrops.size(); i++) {
+    int side = region_strip.beyond(raindrops[i].position.x);
+    if (side != -1 && region_links->up(side)) {
+      handed_raindrops[side].push_back(raindrop_entry(raindrops[i]));
+      ghost_raindrops[raindrops[i].raindrop_id] = {side, hold, raindrops[i]};
+      continue;
+    }
+    if (kept != i)
+      raindrops[kept] = raindrops[i];
+    kept++;
+  }
+  raindrops.erase(raindrops.begin() + kept, raindrops.end());
+}
+
+// takes the player out of the room but for its ghost and has the reactor
+// give its socket up. finish_player_handoff() sends both over once it has
+void Room::begin_player_handoff(int id, int side) {
+  client c = clients.at(id);
+  int from = index;
+  if (!c->room.compare_exchange_strong(from, ROOM_HANDED_OFF))
+    return; // closed in the meantime, the close is on its way
+  population--;
+
+  Player &p = game.players.at(id);
+  if (id == assassin_id) {
+    p.color = original_assassin_color;
+    broadcast_message(
+        netvent::serialize_to_netvent(
+            netvent::val(MSG_PLAYER_UPDATE),
+            std::map<std::string, netvent::Value>(
+                {{"id", netvent::val(id)},
+                 {"username", netvent::val(p.username)},
+                 {"color", netvent::val(color_to_table(p.color))}})),
+        clients, id);
+    clear_assassin_state();
+  }
+  p.is_shooting = false;
+
+  Handoff h;
+  h.side = side;
+  h.c = c;
+  auto session = sessions.find(id);
+  h.token = session != sessions.end() ? session->second.token : 0;
+  // nothing more is sent to the client from here on, so this is what it
+  // will have been told of
+  std::vector<netvent::Value> known;
+  for (auto &[other, player] : game.players) {
+    h.known.push_back(other);
+    known.push_back(netvent::val(other));
+  }
+  h.state = netvent::serialize_to_netvent(
+      netvent::val(REGION_PLAYER),
+      std::map<std::string, netvent::Value>(
+          {{"id", netvent::val(id)},
+           {"player", netvent::val(p.to_table(id))},
+           {"version", netvent::val(c->version)},
+           {"caps", netvent::val((int)c->caps)},
+           {"session", netvent::val(h.token)},
+           {"known", netvent::val(netvent::Table(known))}}));
+
+  sessions.erase(id);
+  clients.erase(id);
+  udp.forget(id);
+  udp_limiters.erase(id);
+  umbrella_shoot_cooldowns.erase(id);
+  ghost_players[id].side = side;
+  handoffs[id] = std::move(h);
+  if (id == assassin_target_id && assassin_id != -1)
+    select_new_target(assassin_id, false);
+
+  reactor->release(c, [this, id, c](int fd, std::string unread) {
+    tick_inbox.post([this, id, c, fd, unread] {
+      auto h = handoffs.find(id);
+      if (h == handoffs.end() || h->second.c != c) {
+        if (fd != -1)
+          close_socket(fd);
+        return;
+      }
+      if (fd == -1) {
+        // the client went away first
+        restore_player(h->second, -1, "");
+        handoffs.erase(h);
+        return;
+      }
+      h->second.released = true;
+      h->second.fd = fd;
+      h->second.unread = unread;
+    });
+  });
+}
+
+// sends a released player over with its socket and what was read off it.
+// if the neighbour cannot take it the player stays here after all
+void Room::finish_player_handoff(int id) {
+  Handoff &h = handoffs.at(id);
+  // frames read before the handoff, then the bytes after them
+  std::string bytes = h.carried + h.unread;
+  std::string message = h.state;
+  message += '\0';
+  message += bytes;
+  if (region_links->send(h.side, message, h.fd)) {
+    close_socket(h.fd);
+    // the neighbour's mirrors take a moment to list it
+    ghost_players[id].held_until = tick_count + server_config.tick_rate;
+    std::cout << "Player " << id << " crossed into the "
+              << RegionLinks::side_name(h.side) << " region" << std::endl;
+  } else {
+    restore_player(h, h.fd, bytes);
+  }
+  handoffs.erase(id);
+}
+
+// a handoff that did not go through: the player is ours again, outside the
+// strip until it can be handed over. with no socket left its session waits
+// for the client to come back, as for any dropped connection
+void Room::restore_player(Handoff &h, int fd, const std::string &bytes) {
+  int id = h.c->id;
+  ghost_players.erase(id);
+  if (!game.players.count(id)) {
+    if (fd != -1)
+      close_socket(fd);
+    return;
+  }
+  if (fd == -1) {
+    if (h.token == 0) {
+      remove_player(id);
+      return;
+    }
+    sessions[id] = {h.token, nullptr,
+                    std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(server_config.session_grace_ms)};
+    return;
+  }
+  client c = attach_player(fd, id, h.c->version, h.c->caps, bytes);
+  if (h.token != 0)
+    sessions[id] = {h.token, c, {}};
+  // it has missed what happened since the handoff began
+  send_region_chunk(c, h.known);
+  send_client_id(c, h.token);
+}
+
+// a connection from another process, or one of ours the reactor has given
+// up, for player `id`. `bytes` were already read off it: the complete
+// frames go to the tick like any others, the rest waits in the reader
+client Room::attach_player(int fd, int id, int version, uint32_t caps,
+                           const std::string &bytes) {
+  client c = std::make_shared<connection>();
+  c->fd = fd;
+  c->id = id;
+  c->room = index;
+  c->version = version;
+  c->caps = caps;
+  c->welcomed.store(true, std::memory_order_release);
+  c->reactor = reactor.get();
+  c->last_heard = std::chrono::steady_clock::now().time_since_epoch().count();
+
+  FrameReader frames;
+  frames.append(bytes.data(), bytes.size());
+  std::string_view frame;
+  while (frames.next(frame))
+    inbound->push(c, frame);
+  std::string rest = frames.take_buffered();
+  c->reader.append(rest.data(), rest.size());
+
+  population++;
+  clients[id] = c;
+  reactor->adopt(c);
+  return c;
+}
+
+// a player crossing in from a neighbour, with its client's socket
+void Room::take_player(int side, const std::string &payload, int fd) {
+  size_t split = payload.find('\0');
+  if (fd == -1 || split == std::string::npos) {
+    std::cerr << "Player handoff from the " << RegionLinks::side_name(side)
+              << " region came without its connection" << std::endl;
+    if (fd != -1)
+      close_socket(fd);
+    return;
+  }
+  try {
+    auto [event_name, data] =
+        netvent::deserialize_from_netvent(payload.substr(0, split));
+    int id = data["id"].as_int();
+    if (clients.count(id) || (game.players.count(id) && !is_ghost(id))) {
+      std::cerr << "Player " << id << " is already here" << std::endl;
+      close_socket(fd);
+      return;
+    }
+    Player p = player_from_table(data["player"].as_table());
+    bool was_ghost = ghost_players.erase(id) != 0;
+    game.players[id] = p;
+    if (!was_ghost)
+      broadcast_message(player_new_message(id, p), clients);
+    else
+      world_update.player_moved(id, p.x, p.y, p.rot);
+
+    client c = attach_player(fd, id, data["version"].as_int(),
+                             (uint32_t)data["caps"].as_int(),
+                             payload.substr(split + 1));
+    int token = data["session"].as_int();
+    if (token != 0)
+      sessions[id] = {token, c, {}};
+
+    std::vector<int> known;
+    for (const netvent::Value &v : data["known"].as_table().get_data_vector())
+      known.push_back(v.as_int());
+    send_region_chunk(c, known);
+    send_client_id(c, token);
+    std::cout << "Player " << id << " crossed in from the "
+              << RegionLinks::side_name(side) << " region" << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << "Bad player handoff: " << e.what() << std::endl;
+    close_socket(fd);
+  }
+}
+
+// everything a client that was being served by another region needs to
+// see this one instead: who is here, who is not, what is in flight and
+// which events are running
+void Room::send_region_chunk(const client &c, const std::vector<int> &known) {
+  WorldUpdate here;
+  for (int id : known)
+    if (id != c->id && !game.players.count(id))
+      here.player_left(id);
+  std::string lines = in_flight_lines(here);
+  send_large_message(join_snapshot.region_chunk(c->id, game.players, lines,
+                                                running_events()),
+                     c);
+}
+
+// players that crossed over go first, so the neighbour has each of them
+// before a mirror that no longer lists it. then both neighbours get what we
+// own near their edge, with the bullets and raindrops that crossed over
+void Room::send_mirrors() {
+  std::vector<int> ready;
+  for (auto &[id, h] : handoffs)
+    if (h.released)
+      ready.push_back(id);
+  for (int id : ready)
+    finish_player_handoff(id);
+
+  float border = server_config.region_border;
+  for (int side : {REGION_LEFT, REGION_RIGHT}) {
+    if (!region_links->up(side))
+      continue;
+    std::map<netvent::Value, netvent::Value> players;
+    for (auto &[id, p] : game.players) {
+      // one on its way over is still ours until it gets there
+      if (is_ghost(id) && !handoffs.count(id))
+        continue;
+      if (region_strip.near(side, p.x + 50, border))
+        players[netvent::val(id)] = netvent::val(p.to_table(id));
+    }
+    std::vector<netvent::Value> bullets, raindrops;
+    for (const Bullet &b : game.bullets)
+      if (region_strip.near(side, b.x, border))
+        bullets.push_back(bullet_entry(b));
+    for (const RainDrop &d : game.raindrops)
+      if (region_strip.near(side, d.position.x, border))
+        raindrops.push_back(raindrop_entry(d));
+
+    std::map<std::string, netvent::Value> data;
+    auto add = [&](const char *key, std::vector<netvent::Value> &list) {
+      if (!list.empty())
+        data[key] = netvent::val(netvent::Table(list));
+    };
+    if (!players.empty())
+      data["players"] = netvent::val(netvent::Table(players));
+    add("bullets", bullets);
+    add("raindrops", raindrops);
+    add("bullets_handed", handed_bullets[side]);
+    add("raindrops_handed", handed_raindrops[side]);
+    region_links->send(
+        side, netvent::serialize_to_netvent(netvent::val(REGION_MIRROR), data));
+    handed_bullets[side].clear();
+    handed_raindrops[side].clear();
+  }
+}
+
+// ---------------------------------
+// END REGIONS
+// ---------------------------------
+
+// copies this tick's state for a reader on another thread that asked for it
+void Room::publish_snapshot() {
+  GameSnapshot &s = snapshots.next();
+  s.tick = tick_count;
+  s.players = game.players;
+  s.bullets = game.bullets;
+  s.raindrops = game.raindrops;
+  s.events = running_events();
+  s.clients.clear();
+  for (const auto &[id, c] : clients)
+    s.clients.push_back({id, c->version, c->caps});
+  snapshots.publish();
+}
+
+// hands everything the shared UDP host has received to the rooms of the
+// players it came from. whichever room's tick gets here first collects for
+// all of them
+void poll_udp() {
+  udp.poll([](int id, std::string packet) {
+    Room *room = room_of_id(id);
+    if (room == nullptr)
+      return;
+    std::lock_guard<std::mutex> lock(room->udp_mutex);
+    room->udp_inbox.emplace_back(id, std::move(packet));
+  });
+}
+
+// this tick's moves from the room's players over UDP
+void Room::take_udp() {
+  poll_udp();
+  udp_batch.clear();
+  {
+    std::lock_guard<std::mutex> lock(udp_mutex);
+    udp_batch.swap(udp_inbox);
+  }
+
+  // only movement is accepted over UDP
+  auto now = limiter_time(tick_count);
+  udp_packets.clear();
+  for (auto &[id, packet] : udp_batch) {
+    if (peek_message_type(packet) != MSG_PLAYER_MOVE)
+      continue;
+    // only throttled: the side channel is lossy anyway, and a flood here
+    // costs no more than the drop
+    if (!udp_limiters[id].allow(MSG_PLAYER_MOVE, now, server_config)) {
+      inbound_drops.count(MSG_PLAYER_MOVE);
+      continue;
+    }
+    auto c = clients.find(id);
+    if (c != clients.end())
+      udp_packets.push_back({c->second, std::move(packet)});
+  }
+}
+
+// one frame from a client, read off its TCP connection or the UDP channel
+void Room::handle_packet(const client &from, const std::string &packet) {
+  // sent before the connection was handed to another room
+  int in_room = from->room;
+  if (in_room == ROOM_HANDED_OFF) {
+    auto h = handoffs.find(from->id);
+    if (h != handoffs.end() && h->second.c == from)
+      h->second.carried += encode_frame(packet);
+    return;
+  }
+  if (in_room != index && in_room != -1)
+    return;
+  // a connection can say hello before admit_joiners() has seen it
+  if (from->id == -1)
+    assign_id(from);
+  int from_id = from->id;
+  try {
+    if (packet.empty())
+      return;
+
+    int packet_type = std::stoi(packet.substr(0, packet.find('\n')));
+    std::string payload = packet; // if we substr the newline, the processing will break
+
+    switch (packet_type) {
+    case 2: {
+      // get the movement data
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 2) {
+        int x = data["x"].as_int();
+        int y = data["y"].as_int();
+        float rot = data["rot"].as_float();
+
+        bool collision_occurred = false;
+        int current_assassin_id = -1;
+        int current_target_id = -1;
+
+        // check assassin collision first
+        {
+          if (assassin_id == from_id && assassin_target_id != -1) {
+            current_assassin_id = assassin_id;
+            current_target_id = assassin_target_id;
+          }
+        }
+
+        // update game state and check collision
+        {
+          if (game.players.find(from_id) == game.players.end())
+            break;
+          game.players.at(from_id).x = x;
+          game.players.at(from_id).y = y;
+          game.players.at(from_id).rot = rot;
+
+          // check if this player is an assassin
+          if (current_assassin_id == from_id &&
+              current_target_id != -1) {
+            if (check_assassin_collision(current_assassin_id,
+                                         current_target_id, x, y,
+                                         rot)) {
+              collision_occurred = true;
+            }
+          }
+        }
+
+        // handle assassination
+        if (collision_occurred) {
+          // ANDY SHALL HANDLE ASSASSIN DAMAGE HERE
+          // TODO: Implement assassin damage
+          std::cout << "ASSASSIN SUCCESS! Player "
+                    << current_assassin_id << " hit target "
+                    << current_target_id << std::endl;
+          // Store current assassin as last assassin
+          last_assassin_id = current_assassin_id;
+
+          // Set assassin to target themselves for 5 seconds
+          {
+            assassin_target_id = current_assassin_id; // Target self
+            pending_assassins[current_assassin_id] =
+                std::chrono::steady_clock::now();
+
+            // Notify assassin of self-targeting
+            std::string event_response = netvent::serialize_to_netvent(
+                netvent::val(MSG_ASSASSIN_CHANGE),
+                std::map<std::string, netvent::Value>({
+                    {"assassin_id", netvent::val(current_assassin_id)},
+                    {"target_id", netvent::val(current_assassin_id)}
+                }));
+
+            auto assassin_client = clients.find(current_assassin_id);
+            if (assassin_client != clients.end()) {
+              send_message(event_response, assassin_client->second);
+              std::cout << "Assassin " << current_assassin_id
+                        << " entering pending period (self-target)"
+                        << std::endl;
+            }
+          }
         }
+
+        // goes out with this tick's world update
+        world_update.player_moved(from_id, x, y, rot);
       }
+    } break;
+    case 5: { // MSG_PLAYER_UPDATE
+      // nothing to apply it to until the sender's player has gone live
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 5) {
+        std::string username = data["username"].as_string();
+        netvent::Table color_table = data["color"].as_table();
 
-      for (auto &cube : cubes) {
-        if (cube.check_collision(drop_rect)) {
-          should_despawn = true;
-          break;
+        std::string sanitized_user = sanitize_username(username);
+
+        {
+          game.players[from_id].username = sanitized_user;
+          game.players[from_id].color = color_from_table(color_table);
+        }
+
+        std::string response = netvent::serialize_to_netvent(
+            netvent::val(5 /* MSG_PLAYER_UPDATE */),
+            std::map<std::string, netvent::Value>(
+                {{"id", netvent::val(from_id)},
+                 {"username", netvent::val(sanitized_user)},
+                 {"color", netvent::val(color_to_table(
+                               game.players[from_id].color))}}));
+        broadcast_message(response, clients, from_id);
+      }
+    } break;
+    case 6: {
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] = netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 6) {
+        unsigned int color_code = data["color_code"].as_int();
+
+
+        game.players[from_id].color = uint_to_color(color_code);
+
+        std::string out = netvent::serialize_to_netvent(
+            netvent::val(6),
+            std::map<std::string, netvent::Value>({
+                {"player_id", netvent::val(from_id)},
+                {"color_code", netvent::val((int)color_code)}
+            }));
+        broadcast_message(out, clients, from_id);
+      }
+    } break;
+    case 10: {
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 10) {
+        int player_id = data["player_id"].as_int();
+        int x = data["x"].as_int();
+        int y = data["y"].as_int();
+        float rot = data["rot"].as_float();
+
+
+        float angleRad = (-rot + 5) * DEG2RAD;
+        float bspeed = 10;
+
+        Vector2 dir = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -bspeed);
+        Vector2 spawnOffset = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -120);
+        Vector2 origin = {(float)game.players[from_id].x + 50,
+                          (float)game.players[from_id].y + 50};
+        Vector2 spawnPos = Vector2Add(origin, spawnOffset);
+
+        int bullet_id = get_next_bullet_id();
+        Bullet new_bullet((int)spawnPos.x, (int)spawnPos.y, dir, from_id, bullet_id);
+        game.bullets.push_back(new_bullet);
+        world_update.bullet_shot(player_id, bullet_id, x, y, rot);
+      }
+    } break;
+    case 12: { // MSG_SWITCH_WEAPON
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 12) {
+        int player_id = data["player_id"].as_int();
+        int weapon_id = data["weapon_id"].as_int();
+
+        if (game.players.find(player_id) != game.players.end()) {
+          game.players[player_id].weapon_id = weapon_id;
+          // Broadcast weapon change to all clients
+          std::string out = netvent::serialize_to_netvent(
+              netvent::val(12 /* MSG_SWITCH_WEAPON */),
+              std::map<std::string, netvent::Value>(
+                  {{"player_id", netvent::val(player_id)},
+                   {"weapon_id", netvent::val(weapon_id)}}));
+          broadcast_message(out, clients, from_id);
+        }
+      }
+    } break;
+    case 17: {
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 17) {
+        int player_id = data["player_id"].as_int();
+        
+        if (game.players.find(player_id) != game.players.end()) {
+          game.players[player_id].is_shooting = true;
+          game.players[player_id].rot = data["rot"].as_float();
+          
+          std::string out = netvent::serialize_to_netvent(
+              netvent::val(17 /* MSG_UMBRELLA_SHOOT */),
+              std::map<std::string, netvent::Value>(
+                  {{"player_id", netvent::val(player_id)},
+                   {"rot", netvent::val(data["rot"].as_float())}}));
+          broadcast_message(out, clients, from_id,
+                            coalesce_key(MSG_UMBRELLA_SHOOT, player_id));
+        }
+      }
+    } break;
+    case 18: {
+      if (game.players.find(from_id) == game.players.end())
+        break;
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      if (event_name.as_int() == 18) {
+        int player_id = data["player_id"].as_int();
+        
+        if (game.players.find(player_id) != game.players.end()) {
+          game.players[player_id].is_shooting = false;
+          
+          // Broadcast umbrella stop shooting state to all other clients.
+          // shares the shoot key: a stop still waiting to be sent is
+          // replaced by the next shoot and vice versa, so a lagging
+          // client only sees the umbrella's latest state
+          std::string out = netvent::serialize_to_netvent(
+              netvent::val(18 /* MSG_UMBRELLA_STOP */),
+              std::map<std::string, netvent::Value>(
+                  {{"player_id", netvent::val(player_id)}}));
+          broadcast_message(out, clients, from_id,
+                            coalesce_key(MSG_UMBRELLA_SHOOT, player_id));
+        }
+      }
+    } break;
+    case MSG_HEARTBEAT:
+      break; // on_data already noted that the client is alive
+    case MSG_HELLO: {
+      // the first message on a connection: a new player, or the
+      // session it wants back
+      auto [event_name, data] =
+          netvent::deserialize_from_netvent(payload);
+      Hello hello;
+      if (data.count("version")) {
+        hello.version = data["version"].as_int();
+        hello.caps = (uint32_t)data["caps"].as_int();
+      }
+      if (data.count("session")) {
+        hello.id = data["id"].as_int();
+        hello.session = data["session"].as_int();
+        hello.tick = data["tick"].as_int();
+      }
+      if (joining_ids.count(from_id))
+        hellos[from_id] = hello;
+    } break;
+    default:
+      std::cerr << "INVALID PACKET TYPE: " << packet_type << std::endl;
+      break;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error processing packet: " << e.what() << std::endl;
+  }
+}
+
+// one tick, `dt` seconds of simulation: events, disconnects, this tick's
+// packets and the simulation, then everything that has to go out is flushed
+void Room::server_tick(float dt) {
+  // console commands and resumes posted since the last tick
+  tick_inbox.run();
+  check_random_event();
+
+  // check pending assassins
+  check_pending_assassins();
+
+  // add raindrops from players
+  auto now = std::chrono::steady_clock::now();
+  
+  for (const auto &[player_id, player] : game.players) {
+    if (player.is_shooting && player.weapon_id == (int)Weapon::umbrella) {
+      // Check if cooldown has passed
+      auto last_shot_it = umbrella_shoot_cooldowns.find(player_id);
+      if (last_shot_it == umbrella_shoot_cooldowns.end() || 
+          std::chrono::duration<float>(now - last_shot_it->second).count() >= UMBRELLA_SHOOT_COOLDOWN) {
+        
+        RainDrop new_drop = raindrop_from_player(player_id);
+        if (new_drop.raindrop_id != -1) { // Valid raindrop created
+          game.raindrops.push_back(new_drop);
+          umbrella_shoot_cooldowns[player_id] = now;
+          world_update.raindrop_spawned(new_drop);
         }
       }
     }
+  }
+
+  remove_closed_clients();
+  expire_sessions();
+  admit_joiners();
+  check_heartbeats();
+
+  // process packets: what the reactor queued since the last tick, in the
+  // order it arrived, then the moves that came in over UDP
+  inbound->drain([&](InboundQueue::Frame &frame) {
+    handle_packet(frame.from, frame.data);
+  });
+
+  take_udp();
+  for (const auto &[from, packet] : udp_packets)
+    handle_packet(from, packet);
+
+  // what the neighbouring regions sent: their edges, and whatever crossed
+  // over from them
+  if (region_links)
+    region_links->poll();
 
-    if (should_despawn) {
-      // Send despawn message to all clients
-      std::string msg = netvent::serialize_to_netvent(
-          netvent::val(MSG_RAINDROP_DESPAWN),
-          std::map<std::string, netvent::Value>({
-              {"raindrop_id", netvent::val(it->raindrop_id)}
-          }));
-      broadcast_message(msg, clients);
+  // update bullets
+  update_bullets(dt);
+  update_raindrops(dt);
 
-      // Remove raindrop
-      it = game.raindrops.erase(it);
+  if (region_links) {
+    hand_off_leavers();
+    send_mirrors();
+  }
+
+  join_snapshot.note_changes(tick_count, game.players);
+
+  // one message with every move, spawn and despawn of this tick. clients
+  // with a UDP peer get the moves there and only the rest over TCP
+  if (!world_update.empty()) {
+    if (world_update.has_moves()) {
+      // a region server's one room has players with any room's ids
+      if (region_links)
+        udp.broadcast(world_update.serialize(true, false, tick_count));
+      else
+        udp.broadcast(world_update.serialize(true, false, tick_count),
+                      id_base, id_base + ROOM_ID_SPAN - 1);
+    }
+
+    // each variant is serialized and compressed at most once
+    std::string full_text, events_text;
+    shared_frame full, events, full_compressed, events_compressed;
+    for (const auto &[id, c] : clients) {
+      bool compress = c->caps & CAP_COMPRESSION;
+      bool with_moves = !udp.connected(id);
+      if (!with_moves && !world_update.has_events())
+        continue;
+      std::string &text = with_moves ? full_text : events_text;
+      if (text.empty())
+        text = world_update.serialize(with_moves, true, tick_count);
+      shared_frame &frame = with_moves ? (compress ? full_compressed : full)
+                                       : (compress ? events_compressed : events);
+      if (!frame)
+        frame = compress ? make_compressed_frame(text) : make_frame(text);
+      reactor->send(c, frame);
+    }
+    world_update.clear();
+    leaving_ids.clear();
+  }
+  udp.flush();
+
+  // hand this tick's outbound data to the kernel
+  reactor->flush();
+  if (snapshots.requested())
+    publish_snapshot();
+  tick_count++;
+}
+
+// ticks the rooms whose index is `thread` modulo the number of tick
+// threads, on that thread's schedule, until the server stops
+void run_tick_thread(size_t thread) {
+  TickScheduler &scheduler = *schedulers[thread];
+  while (server_running) {
+    int due = scheduler.wait();
+    for (int i = 0; i < due && server_running; i++) {
+      auto start = std::chrono::steady_clock::now();
+      for (size_t r = thread; r < rooms.size(); r += schedulers.size())
+        rooms[r]->server_tick(scheduler.dt());
+      scheduler.ran(std::chrono::steady_clock::now() - start);
+    }
+  }
+}
+
+std::unique_ptr<Reactor> make_reactor(int argc, char **argv) {
+  std::string io = "epoll";
+  bool zerocopy = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--io" && i + 1 < argc) {
+      io = argv[++i];
+    } else if (arg == "--zerocopy") {
+      zerocopy = true;
+    }
+  }
+
+  if (io == "uring")
+    return std::make_unique<UringReactor>(zerocopy);
+  if (io != "epoll")
+    std::cerr << "Unknown I/O backend '" << io << "', using epoll" << std::endl;
+  return std::make_unique<EpollReactor>();
+}
+
+// --loopback N [--ticks T] [--join-burst B] [--reconnect R] [--compress]
+// [--train-dict] [--flood F] [--rooms R] [--early-update]: runs the server tick against N in-memory clients that
+// each move once per tick. no sockets,
+// no reactor or event threads and no sleeping between ticks, so the numbers
+// are the cost of the tick itself and two runs with the same arguments do the
+// same work.
+// with --join-burst, B more clients connect at once halfway through and the
+// slowest tick is reported next to the average. with --reconnect, R clients
+// drop their connection three quarters of the way through and come straight
+// back, half of them resuming their sessions and half joining as new
+// players, and the game state each half was sent is compared.
+// with --compress the clients negotiate compression and the state sizes
+// are what went over the wire. with --train-dict the distinct large
+// messages the clients got are used to train a compression dictionary,
+// which is printed ready to paste into compress.hpp.
+// with --flood F one more client sends F bullet shots every tick, to see
+// what the inbound rate limits let through and what that costs the tick.
+// with --rooms the clients are placed in R rooms the way server_conf
+// room_capacity says, every room is ticked in turn on the one thread and
+// the time per tick is for all of them. reconnecting clients may land in
+// another room first and be handed back to their own.
+// with --early-update one more client sends a player update right after its
+// hello, before it has been admitted. once it has joined, its player has to
+// be the one go_live() made, at the spawn point and not renamed; the exit
+// status is 1 otherwise
+int run_loopback(int count, int ticks, int burst, int reconnects,
+                 bool compress, bool train, int flood, bool early) {
+  auto owned = std::make_unique<LoopbackReactor>();
+  LoopbackReactor *loopback = owned.get();
+  reactor = std::move(owned);
+  loopback_clock = true;
+  schedulers.push_back(std::make_unique<TickScheduler>(
+      server_config.tick_rate, server_config.max_catch_up_ticks));
+  TickScheduler *scheduler = schedulers.front().get();
+  jobs = std::make_unique<JobSystem>(job_threads());
+  make_rooms();
+  attach_reactor();
+  // every room in turn, on this thread
+  auto tick_rooms = [&] {
+    for (auto &room : rooms)
+      room->server_tick(scheduler->dt());
+  };
+
+  // a client end, with what it needs to resume its session
+  struct Bot {
+    std::unique_ptr<Transport> server;
+    FrameReader reader;
+    int id = -1;
+    int session = 0;
+    int tick = 0;
+    bool waiting = true; // no MSG_CLIENT_ID since connecting
+    bool resumed = false;
+    uint64_t state_bytes = 0; // MSG_GAME_STATE or MSG_RESUME since connecting
+  };
+  std::vector<Bot> bots;
+  auto connect = [&](Bot &b) {
+    std::map<std::string, netvent::Value> hello = {
+        {"version", netvent::val(PROTOCOL_VERSION)},
+        {"caps", netvent::val((int)CAP_RESUME |
+                              (compress ? (int)CAP_COMPRESSION : 0))}};
+    if (b.session != 0) {
+      hello["id"] = netvent::val(b.id);
+      hello["session"] = netvent::val(b.session);
+      hello["tick"] = netvent::val(b.tick);
+    }
+    b.server = loopback->connect();
+    b.reader = FrameReader();
+    b.waiting = true;
+    b.resumed = false;
+    b.state_bytes = 0;
+    b.server->send(
+        netvent::serialize_to_netvent(netvent::val(MSG_HELLO), hello));
+  };
+  auto connect_more = [&](int n) {
+    for (int i = 0; i < n; i++) {
+      bots.emplace_back();
+      connect(bots.back());
+    }
+  };
+
+  uint64_t frames_in = 0;
+  uint64_t bytes_in = 0;
+  uint64_t joins = 0, join_bytes = 0;
+  uint64_t resumes = 0, resume_bytes = 0;
+  bool measure_rejoins = false;
+  std::set<std::string> samples; // a broadcast reaches every bot, once is enough
+  size_t sample_bytes = 0;
+  auto receive_all = [&] {
+    for (size_t i = 0; i < bots.size(); i++) {
+      Bot &b = bots[i];
+      int received = b.server->receive(b.reader);
+      if (received > 0)
+        bytes_in += received;
+      std::string_view frame;
+      std::string unpacked;
+      while (b.reader.next(frame)) {
+        frames_in++;
+        size_t wire_size = frame.size();
+        if (is_compressed_message(frame)) {
+          if (!decompress_message(frame, unpacked)) {
+            std::cerr << "Bot " << i << " got a corrupt message" << std::endl;
+            continue;
+          }
+          frame = unpacked;
+        }
+        if (train && sample_bytes < (4 << 20) &&
+            frame.size() >= (size_t)server_config.compress_min_bytes) {
+          if (samples.emplace(frame).second)
+            sample_bytes += frame.size();
+        }
+        int type = std::atoi(std::string(frame.substr(0, 3)).c_str());
+        if (type == MSG_WORLD_UPDATE || type == MSG_HEARTBEAT) {
+          size_t at = frame.find("\ntick ");
+          if (at != std::string_view::npos)
+            b.tick = std::atoi(frame.data() + at + 6);
+        } else if (type == MSG_GAME_STATE || type == MSG_RESUME) {
+          b.resumed = type == MSG_RESUME;
+          b.state_bytes += wire_size;
+        } else if (type == MSG_CLIENT_ID && b.waiting) {
+          auto [event_name, data] =
+              netvent::deserialize_from_netvent(std::string(frame));
+          b.id = data["id"].as_int();
+          b.session = data["session"].as_int();
+          b.waiting = false;
+          if (measure_rejoins) {
+            (b.resumed ? resumes : joins)++;
+            (b.resumed ? resume_bytes : join_bytes) += b.state_bytes;
+          }
+        }
+      }
+    }
+  };
+  auto joins_pending = [&] {
+    for (auto &room : rooms) {
+      std::lock_guard<std::mutex> lock(room->admission_mutex);
+      if (!room->admission_queue.empty() || !room->joining.empty())
+        return true;
+    }
+    return false;
+  };
+
+  // the initial joins are not part of the measurement
+  connect_more(count);
+  if (flood > 0)
+    connect_more(1); // bots[count]
+  size_t early_at = bots.size();
+  if (early) {
+    connect_more(1);
+    bots[early_at].server->send(netvent::serialize_to_netvent(
+        netvent::val(MSG_PLAYER_UPDATE),
+        std::map<std::string, netvent::Value>(
+            {{"username", netvent::val("early")},
+             {"color", netvent::val(color_to_table(BLUE))}})));
+  }
+  int join_ticks = 0;
+  while (joins_pending()) {
+    loopback->deliver();
+    tick_rooms();
+    receive_all();
+    join_ticks++;
+  }
+  frames_in = bytes_in = 0;
+
+  // only deliver() and the tick are timed, not the clients
+  std::chrono::duration<double> elapsed{0};
+  std::chrono::duration<double> slowest{0};
+  uint64_t flood_sent = 0;
+  int flooder_gone_at = -1;
+  for (int t = 0; t < ticks; t++) {
+    if (burst > 0 && t == ticks / 2)
+      connect_more(burst);
+    if (t == ticks * 3 / 4) {
+      measure_rejoins = true;
+      for (int i = 0; i < std::min(reconnects, count); i++) {
+        if (i % 2 == 1)
+          bots[i].session = 0; // comes back as a new player
+        connect(bots[i]);      // drops the old connection
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      float angle = i + t * 0.05f;
+      bots[i].server->send(netvent::serialize_to_netvent(
+          netvent::val(MSG_PLAYER_MOVE),
+          std::map<std::string, netvent::Value>(
+              {{"x", netvent::val(400 + (int)(cosf(angle) * 300))},
+               {"y", netvent::val(400 + (int)(sinf(angle) * 300))},
+               {"rot", netvent::val(angle)}})));
+    }
+    for (int i = 0; i < flood && flooder_gone_at < 0; i++) {
+      if (!bots[count].server->send(netvent::serialize_to_netvent(
+              netvent::val(MSG_BULLET_SHOT),
+              std::map<std::string, netvent::Value>(
+                  {{"player_id", netvent::val(bots[count].id)},
+                   {"x", netvent::val(400)},
+                   {"y", netvent::val(400)},
+                   {"rot", netvent::val((float)i)}}))))
+        flooder_gone_at = t;
+      else
+        flood_sent++;
+    }
+    auto start = std::chrono::steady_clock::now();
+    loopback->deliver();
+    tick_rooms();
+    auto took = std::chrono::steady_clock::now() - start;
+    scheduler->ran(took);
+    elapsed += took;
+    slowest = std::max<std::chrono::duration<double>>(slowest, took);
+    receive_all();
+  }
+
+  std::cout << count << " loopback clients (joined in " << join_ticks
+            << " ticks), " << ticks << " ticks: "
+            << elapsed.count() * 1e6 / ticks << " us per tick, slowest "
+            << slowest.count() * 1e6 << " us, " << frames_in << " frames ("
+            << (uint64_t)(frames_in / elapsed.count()) << "/s, "
+            << bytes_in / 1024 << " KiB) delivered, " << scheduler->overruns
+            << " over the " << scheduler->budget_us() << " us budget"
+            << std::endl;
+  if (rooms.size() > 1) {
+    std::cout << "rooms:";
+    for (auto &room : rooms)
+      std::cout << " " << room->game.players.size();
+    std::cout << " players" << std::endl;
+  }
+  if (burst > 0)
+    std::cout << burst << " more clients joined at tick " << ticks / 2
+              << (joins_pending() ? ", some still joining" : "") << std::endl;
+  if (reconnects > 0)
+    std::cout << "reconnected at tick " << ticks * 3 / 4 << ": " << resumes
+              << " resumed with " << (resumes ? resume_bytes / resumes : 0)
+              << " bytes of state each, " << joins << " joined again with "
+              << (joins ? join_bytes / joins : 0) << std::endl;
+  if (compress)
+    compression_stats.print(std::cout);
+  if (flood > 0) {
+    std::cout << "flooder sent " << flood_sent << " shots, "
+              << inbound_drops.by_type[MSG_BULLET_SHOT] << " dropped, ";
+    if (flooder_gone_at >= 0)
+      std::cout << "disconnected by tick " << flooder_gone_at << std::endl;
+    else
+      std::cout << "still connected" << std::endl;
+  }
+  bool early_ok = true;
+  if (early) {
+    int id = bots[early_at].id;
+    Room *room = room_of_id(id);
+    early_ok = false;
+    if (!room || !room->game.players.count(id)) {
+      std::cout << "early update: client " << id << " has no player";
     } else {
-      ++it;
+      const Player &p = room->game.players.at(id);
+      Vector2 spawn = room->spawn_point();
+      early_ok = p.username == "unset" && p.x == spawn.x && p.y == spawn.y;
+      std::cout << "early update: client " << id << " is '" << p.username
+                << "' at " << p.x << "," << p.y;
+    }
+    std::cout << (early_ok ? ", ok" : ", FAILED") << std::endl;
+  }
+  if (train) {
+    std::string dict = train_dictionary({samples.begin(), samples.end()}, 4096);
+    std::cout << "// " << dict.size() << " bytes from " << samples.size()
+              << " messages\ninline const char PRESET_DICTIONARY[] =";
+    for (size_t i = 0; i < dict.size(); i++) {
+      if (i % 64 == 0)
+        std::cout << "\n    \"";
+      unsigned char ch = dict[i];
+      if (ch == '\n')
+        std::cout << "\\n";
+      else if (ch == '"' || ch == '\\')
+        std::cout << '\\' << ch;
+      else if (ch < 32 || ch > 126)
+        std::cout << '\\' << (char)('0' + (ch >> 6)) << (char)('0' + (ch >> 3 & 7))
+                  << (char)('0' + (ch & 7));
+      else
+        std::cout << ch;
+      if (i % 64 == 63 || i + 1 == dict.size())
+        std::cout << '"';
+    }
+    std::cout << ";" << std::endl;
+  }
+  return early_ok ? 0 : 1;
+}
+
+// --queue-bench N: N move-sized frames are pushed by 8, 64 and then 256
+// producer threads at once while one consumer drains them, first through
+// a mutex and a std::list swapped out per batch, the way packets were
+// queued before, then through the InboundQueue ring as configured, then
+// through a ring big enough to never spill. prints frames per second for
+// each, how many frames spilled, and whether every producer's frames came
+// out in the order they were pushed. none of that is paced by a tick, so
+// the configured ring spills most of it by design. the last runs are shaped
+// like a tick instead: room_capacity producers each push a full second of
+// their rate limits, then the consumer drains, over rings from 1024 slots
+// up to the configured size, printing how much of it spilled
+void run_queue_bench(int frames) {
+  typedef std::chrono::steady_clock clock;
+  const client none;
+
+  // each frame is "2\n<producer> <seq>\n" padded to the size of a move
+  auto make_frame = [](int producer, int seq) {
+    std::string f = "2\n" + std::to_string(producer) + " " +
+                    std::to_string(seq) + "\n";
+    f.resize(40, ' ');
+    return f;
+  };
+  // checks a frame against the last seq seen from its producer
+  struct Order {
+    std::vector<int> next;
+    uint64_t wrong = 0;
+    void check(const std::string &f) {
+      char *end;
+      long producer = std::strtol(f.c_str() + 2, &end, 10);
+      long seq = std::strtol(end, nullptr, 10);
+      if (seq != next[producer])
+        wrong++;
+      next[producer] = seq + 1;
+    }
+  };
+
+  // runs `producers` threads calling push(producer, frame) and the consumer
+  // calling drain(order) until it has seen every frame
+  auto run = [&](int producers, auto push, auto drain) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    int each = std::max(1, frames / producers);
+    for (int p = 0; p < producers; p++) {
+      threads.emplace_back([&, p] {
+        std::vector<std::string> mine;
+        for (int i = 0; i < each; i++)
+          mine.push_back(make_frame(p, i));
+        while (!go)
+          std::this_thread::yield();
+        for (const std::string &f : mine)
+          push(f);
+      });
+    }
+    Order order;
+    order.next.assign(producers, 0);
+    uint64_t total = (uint64_t)each * producers, seen = 0;
+    auto start = clock::now();
+    go = true;
+    while (seen < total) {
+      size_t n = drain(order);
+      if (n == 0)
+        std::this_thread::yield();
+      seen += n;
+    }
+    double secs = std::chrono::duration<double>(clock::now() - start).count();
+    for (auto &t : threads)
+      t.join();
+    return std::make_pair(total / secs, order.wrong);
+  };
+
+  std::cout << "queue bench: " << frames << " frames per run, "
+            << std::thread::hardware_concurrency() << " hardware threads"
+            << std::endl;
+  for (int producers : {8, 64, 256}) {
+    std::mutex list_mutex;
+    std::list<std::pair<client, std::string>> list;
+    auto [list_rate, list_wrong] = run(
+        producers,
+        [&](const std::string &f) {
+          std::lock_guard<std::mutex> lock(list_mutex);
+          list.push_back({none, f});
+        },
+        [&](Order &order) {
+          std::list<std::pair<client, std::string>> batch;
+          {
+            std::lock_guard<std::mutex> lock(list_mutex);
+            batch.swap(list);
+          }
+          for (const auto &[from, f] : batch)
+            order.check(f);
+          return batch.size();
+        });
+
+    auto ring = [&](InboundQueue &queue) {
+      auto [rate, wrong] = run(
+          producers, [&](const std::string &f) { queue.push(none, f); },
+          [&](Order &order) {
+            return queue.drain(
+                [&](InboundQueue::Frame &frame) { order.check(frame.data); });
+          });
+      std::cout << ", " << queue.capacity() << " slot ring "
+                << (uint64_t)rate << " frames/s (" << rate / list_rate
+                << "x, " << 100.0 * queue.spilled / frames << "% spilled, "
+                << wrong << " out of order)";
+    };
+
+    std::cout << producers << " producers: list " << (uint64_t)list_rate
+              << " frames/s (" << list_wrong << " out of order)";
+    InboundQueue configured(inbound_queue_slots(),
+                            server_config.inbound_queue_full != "drop");
+    ring(configured);
+    InboundQueue roomy(frames, true, 48);
+    ring(roomy);
+    std::cout << std::endl;
+  }
+
+  int seats = std::max(1, server_config.room_capacity);
+  int burst = server_config.move_rate + server_config.shot_rate +
+              server_config.action_rate + server_config.message_rate;
+  int ticks = std::max(1, frames / (seats * std::max(1, burst)));
+  std::cout << "per tick: " << seats << " producers x " << burst
+            << " frames, " << ticks << " ticks:";
+  size_t configured = InboundQueue(inbound_queue_slots(), true).capacity();
+  for (size_t slots = std::min<size_t>(1024, configured); slots <= configured;
+       slots *= 2) {
+    InboundQueue queue(slots, true);
+    Order order;
+    order.next.assign(seats, 0);
+    uint64_t total = 0;
+    for (int tick = 0; tick < ticks; tick++) {
+      std::vector<std::thread> threads;
+      for (int p = 0; p < seats; p++) {
+        threads.emplace_back([&, p] {
+          for (int i = 0; i < burst; i++)
+            queue.push(none, make_frame(p, tick * burst + i));
+        });
+      }
+      for (auto &t : threads)
+        t.join();
+      total += queue.drain(
+          [&](InboundQueue::Frame &frame) { order.check(frame.data); });
+    }
+    std::cout << " " << queue.capacity() << " slots "
+              << 100.0 * queue.spilled / std::max<uint64_t>(1, total)
+              << "% spilled (" << order.wrong << " out of order)";
+  }
+  std::cout << std::endl;
+}
+
+// --jobs-bench T: 10000 bullets and 10000 raindrops (--entities N each)
+// scattered over the open parts of the map, where live ones are, among 100
+// players, are updated 100 times with 1, 2, ... T job threads. prints the
+// time per update and the speedup over one thread as a chart, and checks
+// that every run despawned the same entities in the same order as the
+// single thread did
+void run_jobs_bench(int max_threads, int entities) {
+  Room room(0);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> across(0, PLAYING_AREA.width);
+  std::uniform_real_distribution<float> unit(-1, 1);
+  for (int id = 0; id < 100; id++)
+    room.game.players[id] = Player((int)across(rng), (int)across(rng));
+  std::vector<Bullet> bullets;
+  std::vector<RainDrop> raindrops;
+  // a spot where a rectangle of `size` at `offset` from it hits nothing
+  auto open_spot = [&](float offset, float size) {
+    for (;;) {
+      Vector2 at = {across(rng), across(rng)};
+      if (!room.hits_obstacle({at.x - offset, at.y - offset, size, size}))
+        return at;
+    }
+  };
+  for (int i = 0; i < entities; i++) {
+    Vector2 at = open_spot(0, 20);
+    bullets.emplace_back((int)at.x, (int)at.y,
+                         Vector2{unit(rng) * 10, unit(rng) * 10},
+                         (int)(across(rng)) % 100, i);
+    RainDrop d;
+    d.position = open_spot(4, 8);
+    d.speed = 300 + 300 * unit(rng);
+    d.size = 4;
+    d.rot = i % 2 ? unit(rng) * PI : 0;
+    d.alpha = 1;
+    d.raindrop_id = i;
+    raindrops.push_back(d);
+  }
+
+  const int updates = 100;
+  float dt = 1.0f / server_config.tick_rate;
+  std::string expected;
+  double single_us = 0;
+  std::cout << "jobs bench: " << entities << " bullets and " << entities
+            << " raindrops, " << updates << " updates, "
+            << std::thread::hardware_concurrency() << " hardware threads"
+            << std::endl;
+  for (int threads = 1; threads <= max_threads; threads++) {
+    jobs = std::make_unique<JobSystem>(threads);
+    std::chrono::steady_clock::duration busy{0};
+    std::string despawned;
+    for (int u = 0; u < updates; u++) {
+      room.game.bullets = bullets;
+      room.game.raindrops = raindrops;
+      room.world_update.clear();
+      auto start = std::chrono::steady_clock::now();
+      room.update_bullets(dt);
+      room.update_raindrops(dt);
+      busy += std::chrono::steady_clock::now() - start;
+      if (u == 0)
+        despawned = room.world_update.serialize(false, true, 0);
     }
+    if (threads == 1)
+      expected = despawned;
+
+    double us =
+        std::chrono::duration<double, std::micro>(busy).count() / updates;
+    if (threads == 1)
+      single_us = us;
+    double speedup = single_us / us;
+    std::cout << std::setw(3) << threads << " threads " << std::setw(9)
+              << std::fixed << std::setprecision(1) << us << " us "
+              << std::setprecision(2) << speedup << "x "
+              << std::string((int)(speedup * 10 + 0.5), '#')
+              << (despawned == expected ? "" : "  (despawns differ!)")
+              << std::endl;
   }
 }
 
-int main() {
+// the TCP listening socket on port 50000, -1 on failure
+int open_listen_socket() {
   int sock = create_socket(ADDRESS_FAMILY_INET, SOCKET_STREAM, 0);
   if (sock < 0) {
     perror("Failed to create socket");
     return -1;
   }
-  server_socket_fd = sock;
 
   socket_address_in sock_addr;
   sock_addr.sin_family = ADDRESS_FAMILY_INET;
@@ -1044,392 +3364,108 @@ int main() {
     return -1;
   }
 
-  if (listen_socket(sock, 5) < 0) {
+  if (listen_socket(sock, SOMAXCONN) < 0) {
     perror("Failed to listen on socket");
     close_socket(sock);
     return -1;
   }
+  return sock;
+}
 
-  std::thread(accept_clients, sock).detach();
-  std::thread(event_worker).detach();
-  std::thread(handle_stdin_commands).detach();
-
-  init_server_objects();
-
-  std::cout << "Running.\n";
-
-  std::signal(SIGINT, shutdown_server);
+// one server process: its rooms, their tick threads and the reactor that
+// feeds them. `channel` is -1 for a standalone server, which accepts on its
+// own socket, or a room server's end of the router channel that its
+// connections arrive over
+int run_server(int argc, char **argv, int channel) {
+  reactor = make_reactor(argc, argv);
+  if (channel != -1 && dynamic_cast<EpollReactor *>(reactor.get()) == nullptr) {
+    std::cerr << "Room servers take connections on the epoll backend"
+              << std::endl;
+    reactor = std::make_unique<EpollReactor>();
+  }
+  make_rooms();
+  if (region_links) {
+    region_links->on_message = [](int side, std::string &payload, int fd) {
+      rooms.front()->region_message(side, payload, fd);
+    };
+    region_links->on_link = [](int side, bool) {
+      rooms.front()->region_link(side);
+    };
+    if (!region_links->open())
+      return -1;
+  }
+  for (int i = 0; i < tick_threads(); i++)
+    schedulers.push_back(std::make_unique<TickScheduler>(
+        server_config.tick_rate, server_config.max_catch_up_ticks));
+  jobs = std::make_unique<JobSystem>(job_threads());
+
+  // a room server's connections come over the router channel instead
+  int sock = channel;
+  if (channel == -1) {
+    sock = open_listen_socket();
+    if (sock < 0)
+      return -1;
+    server_socket_fd = sock;
+  } else {
+    reactor->passed_connections = true;
+  }
 
-  while (server_running) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-    // check pending assassins
-    check_pending_assassins();
-
-    // add raindrops from players
-    {
-      std::lock_guard<std::mutex> cooldown_lock(umbrella_cooldown_mutex);
-      auto now = std::chrono::steady_clock::now();
-      
-      for (const auto &[player_id, player] : game.players) {
-        if (player.is_shooting && player.weapon_id == (int)Weapon::umbrella) {
-          // Check if cooldown has passed
-          auto last_shot_it = umbrella_shoot_cooldowns.find(player_id);
-          if (last_shot_it == umbrella_shoot_cooldowns.end() || 
-              std::chrono::duration<float>(now - last_shot_it->second).count() >= UMBRELLA_SHOOT_COOLDOWN) {
-            
-            RainDrop new_drop = raindrop_from_player(player_id);
-            if (new_drop.raindrop_id != -1) { // Valid raindrop created
-              game.raindrops.push_back(new_drop);
-              umbrella_shoot_cooldowns[player_id] = now;
-              
-              // Send raindrop spawn message to all clients
-              std::string msg = netvent::serialize_to_netvent(
-                  netvent::val(MSG_RAINDROP_SPAWN),
-                  std::map<std::string, netvent::Value>({
-                      {"raindrop_id", netvent::val(new_drop.raindrop_id)},
-                      {"x", netvent::val(new_drop.position.x)},
-                      {"y", netvent::val(new_drop.position.y)},
-                      {"speed", netvent::val(new_drop.speed)},
-                      {"size", netvent::val(new_drop.size)},
-                      {"rot", netvent::val(new_drop.rot)},
-                      {"alpha", netvent::val(new_drop.alpha)}
-                  }));
-              broadcast_message(msg, clients);
-            }
-          }
-        }
-      }
+  if (!reactor->open(sock)) {
+    if (dynamic_cast<EpollReactor *>(reactor.get()) != nullptr) {
+      close_socket(sock);
+      return -1;
     }
-
-    // terminate disconnected clients
-    std::list<int> to_remove;
-    {
-      std::lock_guard<std::mutex> lo(running_mutex);
-      if (!is_running.empty()) {
-        for (auto &[id, v] : is_running) {
-          if (!v) {
-            to_remove.push_back(id);
-          }
-        }
-      }
+    std::cerr << "Falling back to the epoll backend" << std::endl;
+    reactor = std::make_unique<EpollReactor>();
+    if (!reactor->open(sock)) {
+      close_socket(sock);
+      return -1;
     }
+  }
+  attach_reactor();
+  udp.open(udp_port);
+  reactor_thread = std::thread([] { reactor->run(server_running); });
+  std::cout << "I/O backend: " << reactor->name() << ", " << rooms.size()
+            << " rooms on " << schedulers.size() << " tick threads"
+            << std::endl;
 
-    if (!to_remove.empty()) {
-      std::scoped_lock all_locks(clients_mutex, game_mutex, running_mutex);
-
-      for (int i : to_remove) {
-        try {
-          auto client_it = clients.find(i);
-          if (client_it == clients.end()) {
-            continue;
-          }
-
-          int socket_fd = client_it->second.first;
-          auto thread_ptr = client_it->second.second;
-
-          if (thread_ptr && thread_ptr->joinable()) {
-            if (socket_fd != -1) {
-              shutdown_socket(socket_fd, SHUTDOWN_BOTH);
-            }
-
-            thread_ptr->join();
-
-            if (socket_fd != -1) {
-              close_socket(socket_fd);
-            }
-          }
-
-          clients.erase(client_it);
-          game.players.erase(i);
-          is_running.erase(i);
-
-          std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-          // notify other clients about disconnection
-          std::string out = netvent::serialize_to_netvent(
-              netvent::val(4 /* MSG_PLAYER_LEFT */),
-              std::map<std::string, netvent::Value>({{"id", netvent::val(i)}}));
-          for (const auto &[client_id, client_data] : clients) {
-            if (client_id != i && client_data.first != -1) {
-              send_message(out, client_data.first);
-            }
+  // the router's terminal is shared, so only a standalone server reads
+  // commands. a room server tells the router how full it is instead, and
+  // once the router is gone it stops when its last player leaves
+  std::thread load_reports;
+  if (channel == -1) {
+    std::thread(handle_stdin_commands).detach();
+  } else {
+    load_reports = std::thread([channel] {
+      for (int n = 0; server_running; n++) {
+        if (n % 10 == 0) {
+          int load = 0;
+          for (auto &room : rooms)
+            load += room->population;
+          if (!send_text(channel, "load " + std::to_string(load)) &&
+              load == 0) {
+            std::cout << "No router and no players left" << std::endl;
+            server_running = false;
           }
-
-          std::cout << "Removed client " << i << std::endl;
-        } catch (const std::exception &e) {
-          std::cerr << "Error cleaning up client " << i << ": " << e.what()
-                    << std::endl;
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
       }
-    }
+    });
+  }
 
-    // process packets
-    {
-      std::lock_guard<std::mutex> lock(packets_mutex);
-      if (!packets.empty()) {
-        packetlist current_packets;
-        current_packets.swap(packets);
-
-        for (const auto &[from_id, packet] : current_packets) {
-          try {
-            if (packet.empty())
-              continue;
-
-            int packet_type = std::stoi(packet.substr(0, packet.find('\n')));
-            std::string payload = packet; // if we substr the newline, the processing will break
-
-            switch (packet_type) {
-            case 2: {
-              // get the movement data
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 2) {
-                int x = data["x"].as_int();
-                int y = data["y"].as_int();
-                float rot = data["rot"].as_float();
-
-                bool collision_occurred = false;
-                int current_assassin_id = -1;
-                int current_target_id = -1;
-
-                // check assassin collision first
-                {
-                  std::lock_guard<std::mutex> assassin_lock(assassin_mutex);
-                  if (assassin_id == from_id && assassin_target_id != -1) {
-                    current_assassin_id = assassin_id;
-                    current_target_id = assassin_target_id;
-                  }
-                }
-
-                // update game state and check collision
-                {
-                  std::lock_guard<std::mutex> z(game_mutex);
-                  if (game.players.find(from_id) == game.players.end())
-                    break;
-                  game.players.at(from_id).x = x;
-                  game.players.at(from_id).y = y;
-                  game.players.at(from_id).rot = rot;
-
-                  // check if this player is an assassin
-                  if (current_assassin_id == from_id &&
-                      current_target_id != -1) {
-                    if (check_assassin_collision(current_assassin_id,
-                                                 current_target_id, x, y,
-                                                 rot)) {
-                      collision_occurred = true;
-                    }
-                  }
-                }
-
-                // handle assassination
-                if (collision_occurred) {
-                  // ANDY SHALL HANDLE ASSASSIN DAMAGE HERE
-                  // TODO: Implement assassin damage
-                  std::cout << "ASSASSIN SUCCESS! Player "
-                            << current_assassin_id << " hit target "
-                            << current_target_id << std::endl;
-                  // Store current assassin as last assassin
-                  last_assassin_id = current_assassin_id;
-
-                  // Set assassin to target themselves for 5 seconds
-                  {
-                    std::scoped_lock locks(game_mutex, assassin_mutex,
-                                           pending_assassin_mutex,
-                                           clients_mutex);
-                    assassin_target_id = current_assassin_id; // Target self
-                    pending_assassins[current_assassin_id] =
-                        std::chrono::steady_clock::now();
-
-                    // Notify assassin of self-targeting
-                    std::string event_response = netvent::serialize_to_netvent(
-                        netvent::val(MSG_ASSASSIN_CHANGE),
-                        std::map<std::string, netvent::Value>({
-                            {"assassin_id", netvent::val(current_assassin_id)},
-                            {"target_id", netvent::val(current_assassin_id)}
-                        }));
-
-                    auto assassin_client = clients.find(current_assassin_id);
-                    if (assassin_client != clients.end()) {
-                      send_message(event_response,
-                                   assassin_client->second.first);
-                      std::cout << "Assassin " << current_assassin_id
-                                << " entering pending period (self-target)"
-                                << std::endl;
-                    }
-                  }
-                }
-
-                // Broadcast movement to other clients
-                {
-                  std::lock_guard<std::mutex> clients_lock(clients_mutex);
-                  for (const auto &[client_id, client_data] : clients) {
-                    if (client_id != from_id && client_data.first != -1) {
-                      std::string out = netvent::serialize_to_netvent(
-                          netvent::val(2 /* MSG_PLAYER_MOVE */),
-                          std::map<std::string, netvent::Value>(
-                              {{"x", netvent::val(x)},
-                               {"y", netvent::val(y)},
-                               {"rot", netvent::val(rot)},
-                               {"id", netvent::val(from_id)}}));
-                      send_message(out, client_data.first);
-                    }
-                  }
-                }
-              }
-            } break;
-            case 5: { // MSG_PLAYER_UPDATE
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 5) {
-                std::string username = data["username"].as_string();
-                netvent::Table color_table = data["color"].as_table();
-
-                std::string sanitized_user = sanitize_username(username);
-
-                {
-                  std::lock_guard<std::mutex> lock(game_mutex);
-                  game.players[from_id].username = sanitized_user;
-                  game.players[from_id].color = color_from_table(color_table);
-                }
-
-                std::string response = netvent::serialize_to_netvent(
-                    netvent::val(5 /* MSG_PLAYER_UPDATE */),
-                    std::map<std::string, netvent::Value>(
-                        {{"id", netvent::val(from_id)},
-                         {"username", netvent::val(sanitized_user)},
-                         {"color", netvent::val(color_to_table(
-                                       game.players[from_id].color))}}));
-                broadcast_message(response, clients, from_id);
-              }
-            } break;
-            case 6: {
-              auto [event_name, data] = netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 6) {
-                unsigned int color_code = data["color_code"].as_int();
-
-                std::scoped_lock locks(game_mutex, clients_mutex);
-
-                game.players[from_id].color = uint_to_color(color_code);
-
-                std::string out = netvent::serialize_to_netvent(
-                    netvent::val(6),
-                    std::map<std::string, netvent::Value>({
-                        {"player_id", netvent::val(from_id)},
-                        {"color_code", netvent::val((int)color_code)}
-                    }));
-                broadcast_message(out, clients, from_id);
-              }
-            } break;
-            case 10: {
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 10) {
-                int player_id = data["player_id"].as_int();
-                int x = data["x"].as_int();
-                int y = data["y"].as_int();
-                float rot = data["rot"].as_float();
-
-                std::scoped_lock locks(game_mutex, clients_mutex);
-
-                float angleRad = (-rot + 5) * DEG2RAD;
-                float bspeed = 10;
-
-                Vector2 dir = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -bspeed);
-                Vector2 spawnOffset = Vector2Scale({cosf(angleRad), -sinf(angleRad)}, -120);
-                Vector2 origin = {(float)game.players[from_id].x + 50,
-                                  (float)game.players[from_id].y + 50};
-                Vector2 spawnPos = Vector2Add(origin, spawnOffset);
-
-                int bullet_id = get_next_bullet_id();
-                Bullet new_bullet((int)spawnPos.x, (int)spawnPos.y, dir, from_id, bullet_id);
-                game.bullets.push_back(new_bullet);
-
-                std::string out = netvent::serialize_to_netvent(
-                    netvent::val(10 /* MSG_BULLET_SHOT */),
-                    std::map<std::string, netvent::Value>(
-                        {{"player_id", netvent::val(player_id)},
-                         {"bullet_id", netvent::val(bullet_id)},
-                         {"x", netvent::val(x)},
-                         {"y", netvent::val(y)},
-                         {"rot", netvent::val(rot)}}));
-                broadcast_message(out, clients);
-              }
-            } break;
-            case 12: { // MSG_SWITCH_WEAPON
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 12) {
-                int player_id = data["player_id"].as_int();
-                int weapon_id = data["weapon_id"].as_int();
-
-                std::scoped_lock locks(game_mutex, clients_mutex);
-                if (game.players.find(player_id) != game.players.end()) {
-                  game.players[player_id].weapon_id = weapon_id;
-                  // Broadcast weapon change to all clients
-                  std::string out = netvent::serialize_to_netvent(
-                      netvent::val(12 /* MSG_SWITCH_WEAPON */),
-                      std::map<std::string, netvent::Value>(
-                          {{"player_id", netvent::val(player_id)},
-                           {"weapon_id", netvent::val(weapon_id)}}));
-                  broadcast_message(out, clients, from_id);
-                }
-              }
-            } break;
-            case 17: {
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 17) {
-                int player_id = data["player_id"].as_int();
-                
-                std::scoped_lock locks(game_mutex, clients_mutex);
-                if (game.players.find(player_id) != game.players.end()) {
-                  game.players[player_id].is_shooting = true;
-                  game.players[player_id].rot = data["rot"].as_float();
-                  
-                  std::string out = netvent::serialize_to_netvent(
-                      netvent::val(17 /* MSG_UMBRELLA_SHOOT */),
-                      std::map<std::string, netvent::Value>(
-                          {{"player_id", netvent::val(player_id)},
-                           {"rot", netvent::val(data["rot"].as_float())}}));
-                  broadcast_message(out, clients, from_id);
-                }
-              }
-            } break;
-            case 18: {
-              auto [event_name, data] =
-                  netvent::deserialize_from_netvent(payload);
-              if (event_name.as_int() == 18) {
-                int player_id = data["player_id"].as_int();
-                
-                std::scoped_lock locks(game_mutex, clients_mutex);
-                if (game.players.find(player_id) != game.players.end()) {
-                  game.players[player_id].is_shooting = false;
-                  
-                  // Broadcast umbrella stop shooting state to all other clients
-                  std::string out = netvent::serialize_to_netvent(
-                      netvent::val(18 /* MSG_UMBRELLA_STOP */),
-                      std::map<std::string, netvent::Value>(
-                          {{"player_id", netvent::val(player_id)}}));
-                  broadcast_message(out, clients, from_id);
-                }
-              }
-            } break;
-            default:
-              std::cerr << "INVALID PACKET TYPE: " << packet_type << std::endl;
-              break;
-            }
-          } catch (const std::exception &e) {
-            std::cerr << "Error processing packet: " << e.what() << std::endl;
-          }
-        }
-      }
-    }
+  std::cout << "Running.\n";
 
-    // update bullets
-    update_bullets();
-    update_raindrops();
-  }
+  std::signal(SIGINT, shutdown_server);
+
+  // the main thread is tick thread 0
+  std::vector<std::thread> tick_pool;
+  for (size_t i = 1; i < schedulers.size(); i++)
+    tick_pool.emplace_back(run_tick_thread, i);
+  run_tick_thread(0);
+  for (auto &t : tick_pool)
+    t.join();
+  if (load_reports.joinable())
+    load_reports.join();
 
   std::cout << "Main loop stopped. Starting cleanup..." << std::endl;
 
@@ -1441,11 +3477,13 @@ int main() {
   });
   force_exit.detach();
 
-  try {
-    std::scoped_lock all_locks(packets_mutex, clients_mutex, game_mutex,
-                               running_mutex);
+  // stop the reactor before clearing what its callbacks feed
+  if (reactor_thread.joinable())
+    reactor_thread.join();
 
-    packets.clear();
+  try {
+    for (auto &room : rooms)
+      room->inbound->clear();
 
     // close sock
     if (server_socket_fd != -1) {
@@ -1454,25 +3492,11 @@ int main() {
       close_socket(server_socket_fd);
     }
 
-    // terminate clients
-    for (auto &[id, client_pair] : clients) {
-      if (client_pair.second && client_pair.second->joinable()) {
-        if (client_pair.first != -1) {
-          shutdown_socket(client_pair.first, SHUTDOWN_BOTH);
-        }
-
-        client_pair.second->join();
-
-        if (client_pair.first != -1) {
-          close_socket(client_pair.first);
-        }
-      }
-    }
-
     // clear data
-    clients.clear();
-    game.players.clear();
-    is_running.clear();
+    for (auto &room : rooms) {
+      room->clients.clear();
+      room->game.players.clear();
+    }
 
     std::cout << "Cleanup complete. Exiting..." << std::endl;
     exit(0);
@@ -1481,3 +3505,107 @@ int main() {
     exit(1);
   }
 }
+
+int main(int argc, char **argv) {
+  server_config.load();
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--jobs-bench" && i + 1 < argc) {
+      int entities = 10000;
+      for (int j = 1; j + 1 < argc; j++)
+        if (std::string(argv[j]) == "--entities")
+          entities = std::atoi(argv[j + 1]);
+      run_jobs_bench(std::atoi(argv[i + 1]), entities);
+      return 0;
+    }
+    if (std::string(argv[i]) == "--queue-bench" && i + 1 < argc) {
+      run_queue_bench(std::atoi(argv[i + 1]));
+      return 0;
+    }
+    if (std::string(argv[i]) == "--loopback" && i + 1 < argc) {
+      int count = std::atoi(argv[i + 1]);
+      int ticks = 1000;
+      int burst = 0;
+      int reconnects = 0;
+      bool compress = false, train = false, early = false;
+      int flood = 0;
+      for (int j = 1; j < argc; j++) {
+        if (std::string(argv[j]) == "--compress")
+          compress = true;
+        else if (std::string(argv[j]) == "--train-dict")
+          train = true;
+        else if (std::string(argv[j]) == "--early-update")
+          early = true;
+        if (j + 1 == argc)
+          break;
+        if (std::string(argv[j]) == "--ticks")
+          ticks = std::atoi(argv[j + 1]);
+        else if (std::string(argv[j]) == "--join-burst")
+          burst = std::atoi(argv[j + 1]);
+        else if (std::string(argv[j]) == "--reconnect")
+          reconnects = std::atoi(argv[j + 1]);
+        else if (std::string(argv[j]) == "--flood")
+          flood = std::atoi(argv[j + 1]);
+        else if (std::string(argv[j]) == "--rooms")
+          server_config.rooms = std::atoi(argv[j + 1]);
+      }
+      return run_loopback(count, ticks, burst, reconnects, compress, train,
+                          flood, early);
+    }
+  }
+
+  // one fd per client, so lift the soft limit as far as we are allowed
+  rlimit fd_limit;
+  if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 &&
+      fd_limit.rlim_cur < fd_limit.rlim_max) {
+    fd_limit.rlim_cur = fd_limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &fd_limit);
+  }
+
+  // --router N: this process only accepts and N forked room servers, each
+  // hosting server_conf `rooms` rooms, run the matches. --regions N: the
+  // same, but the N processes share one map, each owning a strip of it
+  int processes = 0, regions = 0;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (std::string(argv[i]) == "--router")
+      processes = std::atoi(argv[i + 1]);
+    else if (std::string(argv[i]) == "--regions")
+      regions = std::atoi(argv[i + 1]);
+  }
+  if (regions > 0) {
+    processes = regions;
+    server_config.rooms = 1;
+    region_cubes = get_rand_cubes(155, CUBE_SIZE);
+  }
+  if (processes <= 0)
+    return run_server(argc, argv, -1);
+
+  int sock = open_listen_socket();
+  if (sock < 0)
+    return -1;
+  server_socket_fd = sock;
+  std::signal(SIGINT, shutdown_server);
+  std::cout << "Routing connections to " << processes
+            << (regions > 0 ? " region servers" : " room servers")
+            << std::endl;
+  // region link names are scoped to this router, so two servers on one
+  // machine keep apart
+  std::string scope = "capybara-" + std::to_string(getpid());
+  RoomRouter router(
+      processes, server_config.rooms * server_config.room_capacity,
+      server_config.rooms * ROOM_ID_SPAN,
+      std::chrono::milliseconds(server_config.hello_timeout_ms),
+      [argc, argv, regions, scope](int index, int channel) {
+        server_socket_fd = -1; // the router's, already closed in the child
+        first_room = index * server_config.rooms;
+        udp_port = UDP_PORT + index;
+        if (regions > 0) {
+          region_strip = RegionStrip::of(index, regions);
+          region_links = std::make_unique<RegionLinks>(scope, index, regions);
+        }
+        return run_server(argc, argv, channel);
+      });
+  int result = router.run(sock, server_running);
+  close_socket(sock);
+  std::cout << "Router stopped." << std::endl;
+  return result;
+}
@@ -0,0 +1,162 @@
+// server tunables, read from data/server_conf at startup
+//
+// the file holds one "key value" pair per line, lines starting with '#' are
+// ignored and missing keys keep their defaults. if the file does not exist
+// it is written with the defaults so there is something to edit.
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+struct ServerConfig {
+public:
+  // simulation ticks per second. a server that falls behind runs up to
+  // max_catch_up_ticks ticks back to back and skips the rest
+  int tick_rate = 60;
+  int max_catch_up_ticks = 4;
+
+  // matches hosted by this process, see Room in server.cpp. new connections
+  // fill the first room with fewer than room_capacity players; once every
+  // room is full the emptiest one takes them. the rooms are ticked by
+  // tick_threads threads, 0 for one per core but no more than there are rooms
+  int rooms = 1;
+  int room_capacity = 32;
+  int tick_threads = 0;
+
+  // per-connection outbound queue, in bytes. a client that stays above the
+  // high watermark for slow_client_timeout_ms, or reaches the hard limit,
+  // is disconnected
+  size_t outbound_high_watermark = 256 * 1024;
+  size_t outbound_low_watermark = 64 * 1024;
+  size_t outbound_max_bytes = 4 * 1024 * 1024;
+  int slow_client_timeout_ms = 5000;
+
+  // the server sends a heartbeat to every client this often and expects
+  // each client to do the same. a client that has sent nothing at all for
+  // idle_timeout_ms is disconnected and its player removed
+  int heartbeat_interval_ms = 2000;
+  int idle_timeout_ms = 10000;
+
+  // the capability bits (see protocol.hpp) the server offers, so a feature
+  // can be switched off for every connection without a new build. a client
+  // that has not said hello after hello_timeout_ms is taken for one built
+  // before the handshake and closed
+  unsigned capabilities = ~0u;
+  int hello_timeout_ms = 1000;
+
+  // inbound messages per second a client may send, per message type, see
+  // rate_limit.hpp. 0 for no limit. moves are generous, the client sends
+  // about 12 a second; shots and the other actions broadcast to everyone.
+  // a client over a limit has messages dropped unread, and one still over
+  // it after rate_limit_timeout_ms is disconnected
+  int move_rate = 120;
+  int shot_rate = 10;
+  int action_rate = 10;
+  int message_rate = 20;
+  int rate_limit_timeout_ms = 3000;
+
+  // frames read off connections wait for the tick in a ring of
+  // inbound_queue_slots preallocated slots, see inbound_queue.hpp, 0 for
+  // enough that every seat in the room can spend a whole second's move,
+  // shot, action and message allowance in one tick without filling it.
+  // when it is full they either spill into a slower unbounded list
+  // ("spill") or are dropped ("drop")
+  size_t inbound_queue_slots = 0;
+  std::string inbound_queue_full = "spill";
+
+  // threads the bullet and raindrop updates are split over, 0 for one per
+  // core, and the fewest entities worth handing to another thread
+  int job_threads = 0;
+  int parallel_grain = 1024;
+
+  // messages at least this big are compressed for connections that
+  // negotiated it, see compress.hpp
+  int compress_min_bytes = 512;
+
+  // a player whose connection drops is kept this long so the client can
+  // reconnect and resume its session instead of joining again
+  int session_grace_ms = 15000;
+
+  // joins are spread over several ticks: at most max_concurrent_joins clients
+  // are being sent the game state at once, each one chunk per tick with up
+  // to join_chunk_players players in it
+  int max_concurrent_joins = 8;
+  int join_chunk_players = 32;
+
+  // behind --regions, players, bullets and raindrops within region_border
+  // pixels of a region's edge are mirrored to the neighbour on that side,
+  // see region.hpp
+  int region_border = 300;
+
+  void load() {
+    if (!std::filesystem::exists("data/server_conf")) {
+      save();
+      return;
+    }
+
+    std::map<std::string, std::string> values;
+    std::ifstream in("data/server_conf");
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream iss(line);
+      std::string key, value;
+      if (!(iss >> key >> value) || key[0] == '#')
+        continue;
+      values[key] = value;
+    }
+
+    fields([&](const char *key, auto &field) {
+      auto it = values.find(key);
+      if (it == values.end())
+        return;
+      std::istringstream(it->second) >> field;
+      values.erase(it);
+    });
+    for (auto &[key, value] : values)
+      std::cerr << "server_conf: unknown key '" << key << "'" << std::endl;
+  }
+
+  void save() {
+    std::filesystem::create_directories("data");
+    std::ofstream out("data/server_conf");
+    fields([&](const char *key, auto &field) {
+      out << key << ' ' << field << '\n';
+    });
+  }
+
+private:
+  // every tunable, in file order
+  template <typename F> void fields(F f) {
+    f("tick_rate", tick_rate);
+    f("max_catch_up_ticks", max_catch_up_ticks);
+    f("rooms", rooms);
+    f("room_capacity", room_capacity);
+    f("tick_threads", tick_threads);
+    f("outbound_high_watermark", outbound_high_watermark);
+    f("outbound_low_watermark", outbound_low_watermark);
+    f("outbound_max_bytes", outbound_max_bytes);
+    f("slow_client_timeout_ms", slow_client_timeout_ms);
+    f("heartbeat_interval_ms", heartbeat_interval_ms);
+    f("idle_timeout_ms", idle_timeout_ms);
+    f("capabilities", capabilities);
+    f("hello_timeout_ms", hello_timeout_ms);
+    f("move_rate", move_rate);
+    f("shot_rate", shot_rate);
+    f("action_rate", action_rate);
+    f("message_rate", message_rate);
+    f("rate_limit_timeout_ms", rate_limit_timeout_ms);
+    f("inbound_queue_slots", inbound_queue_slots);
+    f("inbound_queue_full", inbound_queue_full);
+    f("job_threads", job_threads);
+    f("parallel_grain", parallel_grain);
+    f("compress_min_bytes", compress_min_bytes);
+    f("session_grace_ms", session_grace_ms);
+    f("max_concurrent_joins", max_concurrent_joins);
+    f("join_chunk_players", join_chunk_players);
+    f("region_border", region_border);
+  }
+};
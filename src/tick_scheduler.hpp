@@ -0,0 +1,85 @@
+// fixed timestep pacing for the server tick
+//
+// ticks are due every 1/tick_rate seconds of wall time. time that passes is
+// added to an accumulator and every full step in it is one tick, so a slow
+// tick is made up for by running the next ones back to back instead of the
+// simulation slowing down. at most max_catch_up ticks run per wake; time
+// beyond that is dropped and counted as skipped rather than letting a
+// backlog snowball. between ticks the thread sleeps until the next deadline
+// instead of a fixed amount.
+//
+// the counters are atomics so the console can read them while the main
+// thread runs
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+class TickScheduler {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // ticks that took longer than their step, ticks dropped because the
+  // server was too far behind, and the slowest tick in microseconds
+  std::atomic<uint64_t> ticks{0};
+  std::atomic<uint64_t> overruns{0};
+  std::atomic<uint64_t> skipped{0};
+  std::atomic<uint64_t> slowest_us{0};
+  std::atomic<uint64_t> busy_us{0}; // total time spent in ticks
+
+  TickScheduler(int rate, int max_catch_up)
+      : step(std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(1.0 / std::max(1, rate)))),
+        max_catch_up(std::max(1, max_catch_up)) {}
+
+  // the simulated time one tick covers, in seconds
+  float dt() const { return std::chrono::duration<float>(step).count(); }
+
+  // sleeps until at least one tick is due and returns how many to run now
+  int wait() {
+    auto now = clock::now();
+    if (last == clock::time_point())
+      last = now - step; // the first tick is due straight away
+    accumulator += now - last;
+    last = now;
+    if (accumulator < step) {
+      std::this_thread::sleep_until(now + (step - accumulator));
+      now = clock::now();
+      accumulator += now - last;
+      last = now;
+    }
+
+    int due = (int)(accumulator / step);
+    if (due > max_catch_up) {
+      skipped += due - max_catch_up;
+      accumulator -= step * (due - max_catch_up);
+      due = max_catch_up;
+    }
+    accumulator -= step * due;
+    return due;
+  }
+
+  // records how long one tick took
+  void ran(clock::duration took) {
+    uint64_t us =
+        std::chrono::duration_cast<std::chrono::microseconds>(took).count();
+    ticks++;
+    busy_us += us;
+    if (took > step)
+      overruns++;
+    if (us > slowest_us)
+      slowest_us = us;
+  }
+
+  double budget_us() const {
+    return std::chrono::duration<double, std::micro>(step).count();
+  }
+
+private:
+  clock::duration step;
+  int max_catch_up;
+  clock::duration accumulator{0};
+  clock::time_point last;
+};
@@ -0,0 +1,133 @@
+// client side of a connection to the server
+//
+// the game client and the bots only talk to the server through a Transport,
+// so the same code runs over a real TCP socket or, with LoopbackTransport
+// from loopback.hpp, entirely in memory inside the server process.
+// (movement over ENet is a separate datagram channel, see udp_channel.hpp)
+#pragma once
+#include "framing.hpp"
+#include "networking.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+#if !_WIN32
+#include <fcntl.h>
+#endif
+
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual const char *name() const = 0;
+
+  // sends one message as a frame. false once the connection is gone
+  virtual bool send(std::string_view payload) = 0;
+
+  // appends whatever has arrived to `reader`. returns the number of bytes
+  // read, 0 if nothing was waiting and -1 once the connection is closed
+  virtual int receive(FrameReader &reader) = 0;
+
+  // ends the connection without letting go of it, so a thread blocked in
+  // receive() wakes up and sees it closed. the one call that is safe while
+  // another thread is inside receive(); close() only once that thread is done
+  virtual void shutdown() = 0;
+
+  virtual void close() = 0;
+};
+
+class TcpTransport : public Transport {
+public:
+  // takes over a connected socket
+  explicit TcpTransport(int fd) : fd(fd) {}
+  ~TcpTransport() override { close(); }
+
+  // nullptr if the server could not be reached. a non-blocking transport
+  // returns 0 from receive() instead of waiting for data
+  static std::unique_ptr<TcpTransport> connect(const std::string &ip,
+                                               int port,
+                                               bool nonblocking = false) {
+    int fd = create_socket(ADDRESS_FAMILY_INET, SOCKET_STREAM, 0);
+    if (fd < 0) {
+      print_socket_error("Failed to create socket");
+      return nullptr;
+    }
+
+    socket_address_in addr;
+    addr.sin_family = ADDRESS_FAMILY_INET;
+    addr.sin_port = host_to_network_short(port);
+    addr.sin_addr.s_addr = ip_string_to_binary(ip.c_str());
+    if (connect_socket(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      print_socket_error("Could not connect to server");
+      close_socket(fd);
+      return nullptr;
+    }
+
+    if (nonblocking) {
+#if _WIN32
+      u_long mode = 1;
+      ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    }
+    return std::make_unique<TcpTransport>(fd);
+  }
+
+  const char *name() const override { return "tcp"; }
+
+  // a non-blocking socket that cannot take the whole frame keeps the rest in
+  // `unsent` and writes it ahead of the next one, so frames never interleave
+  bool send(std::string_view payload) override {
+    if (fd < 0)
+      return false;
+    append_frame(unsent, payload);
+    size_t sent = 0;
+    while (sent < unsent.size()) {
+      int n = send_data(fd, unsent.data() + sent, unsent.size() - sent,
+                        SEND_NO_SIGNAL);
+      if (n < 0 && socket_would_block())
+        break;
+      if (n < 0) {
+        print_socket_error("error sending message");
+        unsent.clear();
+        return false;
+      }
+      sent += n;
+    }
+    unsent.erase(0, sent);
+    return true;
+  }
+
+  int receive(FrameReader &reader) override {
+    if (fd < 0)
+      return -1;
+    int received = recv_data(fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      reader.append(buffer, received);
+      return received;
+    }
+    if (received < 0 && socket_would_block())
+      return 0;
+    if (received < 0)
+      print_socket_error("Error receiving packet");
+    return -1;
+  }
+
+  void shutdown() override {
+    if (fd >= 0)
+      shutdown_socket(fd, SHUTDOWN_BOTH);
+  }
+
+  void close() override {
+    if (fd < 0)
+      return;
+    shutdown_socket(fd, SHUTDOWN_BOTH);
+    close_socket(fd);
+    fd = -1;
+  }
+
+private:
+  int fd;
+  std::string unsent; // the tail of a frame the socket could not take yet
+  char buffer[16 * 1024];
+};
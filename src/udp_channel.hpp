@@ -0,0 +1,274 @@
+// unreliable side channel for movement, on top of ENet
+//
+// the TCP connection stays the reliable ordered channel for joins, events,
+// spawns and despawns. movement (position and rotation, which is also the
+// umbrella aim) goes over ENet on UDP_PORT instead, so one lost datagram is
+// simply superseded by the next move rather than holding back everything
+// queued behind it. packets on MOVEMENT_CHANNEL are sent unreliable and
+// sequenced: ENet drops any that arrive older than the newest one already
+// received on the channel, so a late move never overwrites a newer one.
+//
+// a client learns its token from MSG_CLIENT_ID and passes it as the connect
+// data, which is how the server ties the UDP peer to the TCP client. clients
+// that never connect (blocked UDP, old builds) keep getting moves over TCP.
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <enet/enet.h>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+const int UDP_PORT = 50001;
+const enet_uint8 MOVEMENT_CHANNEL = 0;
+const size_t UDP_CHANNELS = 1;
+
+// unreliable sequenced. large updates are fragmented without turning them
+// reliable
+const enet_uint32 MOVEMENT_PACKET_FLAGS = ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+
+class UdpServerChannel {
+public:
+  ~UdpServerChannel() {
+    if (host != nullptr) {
+      enet_host_destroy(host);
+      enet_deinitialize();
+    }
+  }
+
+  // false if ENet could not bind; the server then runs TCP only
+  bool open(int port, size_t max_peers = 4095) {
+    if (enet_initialize() != 0) {
+      std::cerr << "ENet failed to initialize" << std::endl;
+      return false;
+    }
+    ENetAddress address;
+    address.host = ENET_HOST_ANY;
+    address.port = port;
+    host = enet_host_create(&address, max_peers, UDP_CHANNELS, 0, 0);
+    if (host == nullptr) {
+      std::cerr << "Could not open UDP port " << port
+                << ", movement stays on TCP" << std::endl;
+      enet_deinitialize();
+      return false;
+    }
+    return true;
+  }
+
+  bool is_open() const { return host != nullptr; }
+
+  // token the client has to connect with. called from the reactor thread
+  // when a client is admitted
+  uint32_t expect(int id) {
+    std::lock_guard<std::mutex> lock(tokens_mutex);
+    uint32_t token;
+    do {
+      token = (uint32_t)std::uniform_int_distribution<int>(1, INT_MAX)(rng);
+    } while (tokens.count(token));
+    tokens[token] = id;
+    return token;
+  }
+
+  // everything below is called by the tick threads. every match room in
+  // the process shares the one host, and ENet is not thread safe, so they
+  // take turns on host_mutex
+
+  // drops the client's token and UDP peer once it has left
+  void forget(int id) {
+    {
+      std::lock_guard<std::mutex> lock(tokens_mutex);
+      for (auto it = tokens.begin(); it != tokens.end(); ++it) {
+        if (it->second == id) {
+          tokens.erase(it);
+          break;
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(host_mutex);
+    auto it = peers.find(id);
+    if (it == peers.end())
+      return;
+    ids.erase(it->second);
+    enet_peer_disconnect_now(it->second, 0);
+    peers.erase(it);
+  }
+
+  bool connected(int id) {
+    std::lock_guard<std::mutex> lock(host_mutex);
+    return peers.count(id) != 0;
+  }
+  size_t peer_count() {
+    std::lock_guard<std::mutex> lock(host_mutex);
+    return peers.size();
+  }
+
+  // handles connects and disconnects and hands every received payload to
+  // on_message(client id, payload), with host_mutex held
+  void poll(const std::function<void(int, std::string)> &on_message) {
+    if (host == nullptr)
+      return;
+    std::lock_guard<std::mutex> lock(host_mutex);
+    ENetEvent event;
+    while (enet_host_service(host, &event, 0) > 0) {
+      switch (event.type) {
+      case ENET_EVENT_TYPE_CONNECT:
+        bind(event.peer, event.data);
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT: {
+        auto it = ids.find(event.peer);
+        if (it != ids.end()) {
+          peers.erase(it->second);
+          ids.erase(it);
+        }
+      } break;
+      case ENET_EVENT_TYPE_RECEIVE: {
+        auto it = ids.find(event.peer);
+        if (it != ids.end())
+          on_message(it->second,
+                     std::string((const char *)event.packet->data,
+                                 event.packet->dataLength));
+        enet_packet_destroy(event.packet);
+      } break;
+      default:
+        break;
+      }
+    }
+  }
+
+  // one packet shared by every connected peer with a client id from
+  // `first_id` to `last_id`, which is one room's players
+  void broadcast(const std::string &payload, int first_id = 0,
+                 int last_id = INT_MAX) {
+    std::lock_guard<std::mutex> lock(host_mutex);
+    if (peers.empty())
+      return;
+    ENetPacket *packet = enet_packet_create(payload.data(), payload.size(),
+                                            MOVEMENT_PACKET_FLAGS);
+    for (auto &[id, peer] : peers)
+      if (id >= first_id && id <= last_id)
+        enet_peer_send(peer, MOVEMENT_CHANNEL, packet);
+    if (packet->referenceCount == 0)
+      enet_packet_destroy(packet);
+  }
+
+  void flush() {
+    if (host == nullptr)
+      return;
+    std::lock_guard<std::mutex> lock(host_mutex);
+    enet_host_flush(host);
+  }
+
+private:
+  ENetHost *host = nullptr;
+  std::mutex host_mutex; // the host, peers and ids
+
+  std::mutex tokens_mutex;
+  std::unordered_map<uint32_t, int> tokens; // token -> client id
+  std::mt19937 rng{std::random_device{}()};
+
+  std::unordered_map<int, ENetPeer *> peers; // bound peers by client id
+  std::unordered_map<ENetPeer *, int> ids;
+
+  void bind(ENetPeer *peer, uint32_t token) {
+    int id;
+    {
+      std::lock_guard<std::mutex> lock(tokens_mutex);
+      auto it = tokens.find(token);
+      if (it == tokens.end()) {
+        enet_peer_disconnect_now(peer, 0);
+        return;
+      }
+      id = it->second;
+    }
+    // the token stays valid so a client whose UDP peer timed out can
+    // connect again; a second peer for the same client replaces the first
+    auto old = peers.find(id);
+    if (old != peers.end()) {
+      ids.erase(old->second);
+      enet_peer_disconnect_now(old->second, 0);
+    }
+    peers[id] = peer;
+    ids[peer] = id;
+  }
+};
+
+class UdpClientChannel {
+public:
+  ~UdpClientChannel() { close(); }
+
+  bool connect(const std::string &ip, int port, uint32_t token) {
+    close();
+    if (enet_initialize() != 0)
+      return false;
+    host = enet_host_create(nullptr, 1, UDP_CHANNELS, 0, 0);
+    if (host == nullptr) {
+      enet_deinitialize();
+      return false;
+    }
+    ENetAddress address;
+    enet_address_set_host(&address, ip.c_str());
+    address.port = port;
+    peer = enet_host_connect(host, &address, UDP_CHANNELS, token);
+    if (peer == nullptr) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // moves only go over UDP once the handshake went through
+  bool connected() const { return up; }
+
+  void poll(const std::function<void(std::string)> &on_message) {
+    if (host == nullptr)
+      return;
+    ENetEvent event;
+    while (enet_host_service(host, &event, 0) > 0) {
+      switch (event.type) {
+      case ENET_EVENT_TYPE_CONNECT:
+        up = true;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        up = false;
+        break;
+      case ENET_EVENT_TYPE_RECEIVE:
+        on_message(std::string((const char *)event.packet->data,
+                               event.packet->dataLength));
+        enet_packet_destroy(event.packet);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  void send(const std::string &payload) {
+    if (!up)
+      return;
+    ENetPacket *packet = enet_packet_create(payload.data(), payload.size(),
+                                            MOVEMENT_PACKET_FLAGS);
+    if (enet_peer_send(peer, MOVEMENT_CHANNEL, packet) < 0)
+      enet_packet_destroy(packet);
+    enet_host_flush(host);
+  }
+
+  void close() {
+    if (host == nullptr)
+      return;
+    if (up)
+      enet_peer_disconnect_now(peer, 0);
+    enet_host_destroy(host);
+    enet_deinitialize();
+    host = nullptr;
+    peer = nullptr;
+    up = false;
+  }
+
+private:
+  ENetHost *host = nullptr;
+  ENetPeer *peer = nullptr;
+  bool up = false;
+};
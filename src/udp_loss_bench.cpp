@@ -0,0 +1,131 @@
+// loopback check for the movement channel under packet loss. a sender and a
+// receiver ENet host run in this process; the receiver's intercept hook
+// throws away a share of the incoming datagrams. moves are sent every 10ms
+// and the receiver keeps sampling how old its newest position is.
+//
+// the reliable run behaves like the TCP stream did: a lost move holds back
+// every move behind it until it is retransmitted. the movement channel drops
+// the lost move and the next one takes its place, so the age of the newest
+// position stays around the send interval.
+//   ./compile.sh lossbench && ./udp_loss_bench
+#include "udp_channel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+const int BENCH_PORT = 50101;
+const int MOVE_INTERVAL_MS = 10;
+const int SECONDS = 5;
+
+using bench_clock = std::chrono::steady_clock;
+
+std::mt19937 rng(1234);
+double loss = 0;
+bool dropping = false; // only once the handshake is done
+
+int drop_some(ENetHost *, ENetEvent *) {
+  if (dropping && std::uniform_real_distribution<double>(0, 1)(rng) < loss)
+    return 1; // handled, i.e. never seen by ENet
+  return 0;
+}
+
+int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             bench_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Result {
+  double p50, p99, max; // age of the newest received move, in ms
+};
+
+Result run(enet_uint32 flags) {
+  ENetAddress address;
+  address.host = ENET_HOST_ANY;
+  address.port = BENCH_PORT;
+  ENetHost *receiver = enet_host_create(&address, 1, UDP_CHANNELS, 0, 0);
+  ENetHost *sender = enet_host_create(nullptr, 1, UDP_CHANNELS, 0, 0);
+  if (receiver == nullptr || sender == nullptr) {
+    std::cerr << "could not create ENet hosts" << std::endl;
+    std::exit(1);
+  }
+  receiver->intercept = drop_some;
+
+  enet_address_set_host(&address, "127.0.0.1");
+  ENetPeer *peer = enet_host_connect(sender, &address, UDP_CHANNELS, 0);
+
+  ENetEvent event;
+  bool up = false;
+  while (!up) {
+    if (enet_host_service(sender, &event, 1) > 0 &&
+        event.type == ENET_EVENT_TYPE_CONNECT)
+      up = true;
+    enet_host_service(receiver, &event, 1);
+  }
+
+  dropping = true;
+  std::vector<double> ages;
+  int64_t newest = now_us(); // send time of the newest move received
+  int64_t start = now_us();
+  int64_t next_move = start;
+  while (now_us() - start < SECONDS * 1000000ll) {
+    int64_t now = now_us();
+    if (now >= next_move) {
+      next_move += MOVE_INTERVAL_MS * 1000;
+      ENetPacket *packet = enet_packet_create(&now, sizeof(now), flags);
+      if (enet_peer_send(peer, MOVEMENT_CHANNEL, packet) < 0)
+        enet_packet_destroy(packet);
+      enet_host_flush(sender);
+    }
+
+    while (enet_host_service(receiver, &event, 0) > 0) {
+      if (event.type != ENET_EVENT_TYPE_RECEIVE)
+        continue;
+      int64_t sent;
+      std::memcpy(&sent, event.packet->data, sizeof(sent));
+      newest = std::max(newest, sent);
+      enet_packet_destroy(event.packet);
+    }
+    enet_host_service(sender, &event, 0); // acks and retransmits
+
+    ages.push_back((now_us() - newest) / 1000.0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  dropping = false;
+
+  enet_peer_disconnect_now(peer, 0);
+  enet_host_destroy(sender);
+  enet_host_destroy(receiver);
+
+  std::sort(ages.begin(), ages.end());
+  return {ages[ages.size() / 2], ages[ages.size() * 99 / 100], ages.back()};
+}
+
+int main() {
+  if (enet_initialize() != 0) {
+    std::cerr << "ENet failed to initialize" << std::endl;
+    return 1;
+  }
+
+  std::cout << std::setw(6) << "loss" << std::setw(26) << "reliable p50/p99/max"
+            << std::setw(26) << "movement p50/p99/max"
+            << "   (ms since the newest move was sent)" << std::endl;
+  for (double l : {0.0, 0.05, 0.2}) {
+    loss = l;
+    Result reliable = run(ENET_PACKET_FLAG_RELIABLE);
+    Result movement = run(MOVEMENT_PACKET_FLAGS);
+    std::cout << std::fixed << std::setprecision(1) << std::setw(5)
+              << l * 100 << "%" << std::setw(10) << reliable.p50
+              << std::setw(8) << reliable.p99 << std::setw(8) << reliable.max
+              << std::setw(10) << movement.p50 << std::setw(8) << movement.p99
+              << std::setw(8) << movement.max << std::endl;
+  }
+
+  enet_deinitialize();
+  return 0;
+}
@@ -0,0 +1,404 @@
+// io_uring connection reactor for the server (linux 6.0+)
+//
+// talks to the kernel through the raw syscalls so there is no liburing
+// dependency. accept and recv are multishot over a group of provided
+// buffers, and every connection's frames for a tick go out as one sendmsg,
+// all of them submitted by a single io_uring_enter from flush().
+#pragma once
+
+#include "reactor.hpp"
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+class UringReactor : public Reactor {
+public:
+  explicit UringReactor(bool zerocopy = false) : zerocopy(zerocopy) {}
+
+  ~UringReactor() override {
+    if (sqes)
+      munmap(sqes, sqes_size);
+    if (ring_ptr)
+      munmap(ring_ptr, ring_size);
+    if (ring_fd != -1)
+      close_socket(ring_fd);
+  }
+
+  const char *name() const override {
+    return zerocopy ? "io_uring (zerocopy)" : "io_uring";
+  }
+
+  bool open(int sock) override {
+    listen_fd = sock;
+
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = QUEUE_DEPTH * 4;
+    ring_fd = (int)syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params);
+    if (ring_fd < 0) {
+      perror("io_uring_setup");
+      return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+      std::cerr << "io_uring: kernel is too old for this backend" << std::endl;
+      return false;
+    }
+
+    ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_ptr = (char *)mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+      perror("io_uring mmap");
+      // the destructor only unmaps what is not null, so whichever of the
+      // two did map is undone here
+      if (ring_ptr != MAP_FAILED)
+        munmap(ring_ptr, ring_size);
+      if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+      ring_ptr = nullptr;
+      sqes = nullptr;
+      return false;
+    }
+
+    sq_head = (unsigned *)(ring_ptr + params.sq_off.head);
+    sq_tail = (unsigned *)(ring_ptr + params.sq_off.tail);
+    sq_mask = *(unsigned *)(ring_ptr + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sq_array = (unsigned *)(ring_ptr + params.sq_off.array);
+    cq_head = (unsigned *)(ring_ptr + params.cq_off.head);
+    cq_tail = (unsigned *)(ring_ptr + params.cq_off.tail);
+    cq_mask = *(unsigned *)(ring_ptr + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(ring_ptr + params.cq_off.cqes);
+    local_tail = *sq_tail;
+
+    std::lock_guard<std::mutex> lock(sq_mutex);
+    buffers.resize((size_t)BUFFER_COUNT * BUFFER_SIZE);
+    provide_buffers(0, BUFFER_COUNT);
+    queue_accept();
+    return true;
+  }
+
+  void run(const std::atomic<bool> &running) override {
+    while (running) {
+      unsigned pending;
+      {
+        std::lock_guard<std::mutex> lock(sq_mutex);
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        pending = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      }
+
+      // submit our own rearms and wait for completions in the same call
+      __kernel_timespec ts{0, 100 * 1000 * 1000};
+      io_uring_getevents_arg arg{};
+      arg.ts = (uint64_t)&ts;
+      int ret = (int)syscall(__NR_io_uring_enter, ring_fd, pending, 1,
+                             IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                             &arg, sizeof(arg));
+      io_syscalls++;
+      if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        perror("io_uring_enter");
+        break;
+      }
+
+      reap();
+    }
+
+    std::unordered_map<uint64_t, client> remaining;
+    remaining.swap(conns);
+    for (auto &[key, c] : remaining)
+      drop(c, false);
+  }
+
+  // push everything queued this tick to the kernel with one io_uring_enter
+  void flush() override {
+    std::vector<client> batch = take_flush_list();
+    if (batch.empty())
+      return;
+
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(sq_mutex);
+    for (const client &c : batch) {
+      std::lock_guard<std::mutex> out_lock(c->out_mutex);
+      start_send_locked(c);
+      settle_locked(c, now);
+    }
+    submit_locked();
+  }
+
+private:
+  static constexpr unsigned QUEUE_DEPTH = 4096;
+  static constexpr unsigned BUFFER_COUNT = 1024; // power of two
+  static constexpr unsigned BUFFER_SIZE = 4096;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+
+  enum Op : uint64_t {
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_SEND = 3,
+    OP_PROVIDE = 4
+  };
+
+  bool zerocopy;
+  int ring_fd = -1;
+  int listen_fd = -1;
+
+  char *ring_ptr = nullptr;
+  size_t ring_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  size_t sqes_size = 0;
+
+  unsigned *sq_head, *sq_tail, *sq_array;
+  unsigned sq_mask, sq_entries;
+  unsigned local_tail = 0;
+  unsigned *cq_head, *cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe *cqes;
+
+  std::vector<char> buffers; // recv buffers handed to the kernel
+
+  // the submission queue is written by the reactor thread and by flush()
+  std::mutex sq_mutex;
+
+  uint64_t next_key = 0;
+  std::unordered_map<uint64_t, client> conns; // reactor thread only
+
+  // caller holds sq_mutex
+  io_uring_sqe *get_sqe() {
+    if (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+      submit_locked();
+    unsigned idx = local_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    local_tail++;
+    return sqe;
+  }
+
+  // caller holds sq_mutex
+  void submit_locked() {
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    unsigned pending = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0)
+      return;
+    if (syscall(__NR_io_uring_enter, ring_fd, pending, 0, 0, nullptr, 0) < 0)
+      perror("io_uring_enter submit");
+    io_syscalls++;
+  }
+
+  // caller holds sq_mutex. entries queued from the reactor thread go out with
+  // its next wait, entries queued by flush() are submitted right away.
+  // (ring mapped buffer groups would save these sqes but are not reliable
+  // on every kernel we run on, the classic opcode is)
+  void provide_buffers(uint16_t first_bid, unsigned count) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = (int)count;
+    sqe->addr = (uint64_t)(buffers.data() + (size_t)first_bid * BUFFER_SIZE);
+    sqe->len = BUFFER_SIZE;
+    sqe->off = first_bid;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = OP_PROVIDE;
+  }
+
+  void recycle_buffer(uint16_t bid) {
+    std::lock_guard<std::mutex> lock(sq_mutex);
+    provide_buffers(bid, 1);
+  }
+
+  void queue_accept() {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+  }
+
+  void queue_recv(const client &c) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = (c->key << 8) | OP_RECV;
+  }
+
+  // caller holds sq_mutex and c->out_mutex. one send in flight per
+  // connection keeps the byte stream ordered. the iovecs point straight at
+  // the queued frames; the queue is a deque so frames appended meanwhile do
+  // not move them, and nothing is popped before the completion arrives
+  void start_send_locked(const client &c) {
+    if (c->send_inflight || c->fd == -1 || c->closing || c->queue.empty())
+      return;
+
+    c->iov.resize(MAX_IOV);
+    c->msg = msghdr{};
+    c->msg.msg_iov = c->iov.data();
+    c->msg.msg_iovlen = gather_locked(c, c->iov.data(), MAX_IOV);
+    c->inflight_frames = c->msg.msg_iovlen;
+
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = zerocopy ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)&c->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (c->key << 8) | OP_SEND;
+    c->send_inflight = true;
+  }
+
+  void reap() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+      io_uring_cqe cqe = cqes[head & cq_mask];
+      head++;
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+      uint64_t op = cqe.user_data & 0xff;
+      if (op == OP_PROVIDE) {
+        if (cqe.res < 0) {
+          errno = -cqe.res;
+          perror("io_uring provide buffers");
+        }
+        continue;
+      }
+      if (op == OP_ACCEPT) {
+        accepted(cqe);
+        continue;
+      }
+
+      auto it = conns.find(cqe.user_data >> 8);
+      if (it == conns.end()) {
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+          recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        continue;
+      }
+      client c = it->second;
+
+      if (op == OP_RECV)
+        received(c, cqe);
+      else if (op == OP_SEND)
+        sent(c, cqe);
+
+      tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  void accepted(const io_uring_cqe &cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      std::lock_guard<std::mutex> lock(sq_mutex);
+      queue_accept();
+    }
+    if (cqe.res < 0) {
+      errno = -cqe.res;
+      perror("Accept failed");
+      return;
+    }
+
+    int fd = cqe.res;
+    int yes = 1;
+    set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    client c = std::make_shared<connection>();
+    c->fd = fd;
+    c->reactor = this;
+    c->key = ++next_key;
+    conns[c->key] = c;
+    {
+      std::lock_guard<std::mutex> lock(sq_mutex);
+      queue_recv(c);
+    }
+
+    if (on_accept)
+      on_accept(c);
+  }
+
+  void received(const client &c, const io_uring_cqe &cqe) {
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+      uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      if (!c->closing && on_data)
+        on_data(c, buffers.data() + (size_t)bid * BUFFER_SIZE, cqe.res);
+      recycle_buffer(bid);
+    } else if (cqe.flags & IORING_CQE_F_BUFFER) {
+      recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    if (cqe.flags & IORING_CQE_F_MORE)
+      return;
+
+    // multishot ended. out of buffers just needs a rearm, anything else is
+    // the peer going away
+    if (cqe.res == -ENOBUFS || cqe.res > 0) {
+      std::lock_guard<std::mutex> lock(sq_mutex);
+      queue_recv(c);
+      return;
+    }
+    drop(c, true);
+  }
+
+  void sent(const client &c, const io_uring_cqe &cqe) {
+    std::lock_guard<std::mutex> sq_lock(sq_mutex);
+    std::lock_guard<std::mutex> lock(c->out_mutex);
+
+    if (!(cqe.flags & IORING_CQE_F_NOTIF)) {
+      if (cqe.res < 0) {
+        close_locked(c);
+      } else {
+        c->inflight_sent += cqe.res;
+        bytes_sent += cqe.res;
+      }
+
+      // zerocopy sends report the result first and only release the buffer
+      // with a separate notification, so it must not be touched until then
+      if (cqe.flags & IORING_CQE_F_MORE)
+        return;
+    }
+
+    consume_locked(c, c->inflight_sent);
+    c->inflight_frames = 0;
+    c->inflight_sent = 0;
+    c->send_inflight = false;
+
+    if (c->fd == -1) {
+      clear_queue_locked(c);
+      conns.erase(c->key);
+    } else {
+      start_send_locked(c);
+    }
+  }
+
+  void drop(const client &c, bool notify) {
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      fd = c->fd;
+      if (fd == -1)
+        return;
+      c->closing = true;
+      c->fd = -1;
+    }
+    close_socket(fd);
+
+    // a send may still be reading the queue; keep the frames and the
+    // connection alive in conns until its completion arrives
+    {
+      std::lock_guard<std::mutex> lock(c->out_mutex);
+      if (!c->send_inflight) {
+        clear_queue_locked(c);
+        conns.erase(c->key);
+      }
+    }
+    if (notify && on_close)
+      on_close(c);
+  }
+};
@@ -5,7 +5,9 @@
 #include "player.hpp"
 #include "constants.hpp"
 #include "drawScale.hpp"
+#include "framing.hpp"
 #include "networking.hpp"
+#include "transport.hpp"
 #include <cstdio>
 #include <map>
 #include <memory>
@@ -20,7 +22,6 @@
 const Color INVISIBLE = BLANK;
 
 typedef std::map<int, Player> playermap;
-typedef std::pair<int, std::shared_ptr<std::thread>> client;
 
 inline bool operator<(const Color& a, const Color& b) {
     if (a.r != b.r) return a.r < b.r;
@@ -102,20 +103,8 @@ struct ColorCompare {
   }
 };
 
-inline void send_message(std::string msg, int sock) {
-  msg.push_back(';');
-  const char *msg_str = msg.c_str();
-  if (send_data(sock, msg_str, msg.size(), 0) < 0) {
-    print_socket_error("error sending message");
-  }
-}
-
-inline void broadcast_message(std::string msg,
-                              std::unordered_map<int, client> clients,
-                              int exclude = -1000) {
-  for (auto &[_, s] : clients)
-    if (_ != exclude)
-      send_message(msg, s.first);
+inline void send_message(const std::string &msg, Transport &server) {
+  server.send(msg);
 }
 
 inline void split(std::string str, std::string splitBy,